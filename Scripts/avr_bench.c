@@ -0,0 +1,303 @@
+/*
+ * Cycle counter for firmware running under simavr.
+ * Scripts/bench.py builds this, finds the symbols, and parses the output.
+ *
+ * Usage: avr_bench firmware.elf mcu f_cpu scenario.txt [options]
+ *   -f name=addr   time calls to the function at this byte address
+ *   -v name=addr   time entry to this interrupt vector
+ *   -l addr        a RAM byte which changes once per main loop iteration
+ *   -o addr        an output register; boot ends when one goes nonzero
+ *                  (can be given up to 4 times)
+ *
+ * Scenario lines are "<ms> <command> [args]":
+ *   adc <channel> <val>  set an ADC input in mV (channel "temp" is the
+ *                        temperature sensor, in simavr's units)
+ *   tap                  short power-off; RAM survives, like a quick click
+ *   off                  long power-off; RAM is lost
+ *   snap <label>         print "snap <label> <ms> <peak>": the highest
+ *                        output register value since the last snap
+ *   end                  stop the simulation
+ *
+ * Output is one line per metric: "name count min avg max" in cycles.
+ * If the firmware goes to sleep with interrupts off (a full shutdown; only
+ * a power cycle would wake it), that ends the run, and the output also has
+ * "halt <ms>" and the I/O registers at that point, as "io <addr> <value>"
+ * lines with data-space addresses.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <simavr/sim_avr.h>
+#include <simavr/sim_elf.h>
+#include <simavr/sim_interrupts.h>
+#include <simavr/avr_adc.h>
+
+#define MAX_PROBES 32
+#define MAX_EVENTS 256
+
+typedef struct {
+    char name[64];
+    uint64_t count, min, max, total;
+} stat_t;
+
+typedef struct {
+    stat_t stat;
+    uint32_t addr;
+    int inside;
+    uint16_t sp;
+    uint64_t start;
+} probe_t;
+
+typedef struct {
+    uint64_t cycle;
+    char cmd[16];
+    char arg1[16];
+    uint32_t arg2;
+} event_t;
+
+static probe_t funcs[MAX_PROBES];
+static int num_funcs;
+static probe_t vectors[MAX_PROBES];
+static int num_vectors;
+static event_t events[MAX_EVENTS];
+static int num_events;
+
+static void stat_add(stat_t *s, uint64_t cycles) {
+    if (! s->count || cycles < s->min) s->min = cycles;
+    if (cycles > s->max) s->max = cycles;
+    s->total += cycles;
+    s->count ++;
+}
+
+static void stat_print(stat_t *s) {
+    if (! s->count) {
+        printf("%s 0 0 0 0\n", s->name);
+        return;
+    }
+    printf("%s %llu %llu %llu %llu\n", s->name,
+           (unsigned long long)s->count, (unsigned long long)s->min,
+           (unsigned long long)(s->total / s->count),
+           (unsigned long long)s->max);
+}
+
+static void add_probe(probe_t *list, int *num, const char *prefix, char *spec) {
+    char *eq = strchr(spec, '=');
+    if (! eq || *num >= MAX_PROBES) {
+        fprintf(stderr, "bad probe: %s\n", spec);
+        exit(1);
+    }
+    *eq = 0;
+    snprintf(list[*num].stat.name, sizeof(list[*num].stat.name),
+             "%s%s", prefix, spec);
+    list[*num].addr = strtoul(eq + 1, NULL, 0);
+    (*num) ++;
+}
+
+static void read_scenario(const char *path, uint32_t f_cpu) {
+    char line[128];
+    FILE *fp = fopen(path, "r");
+    if (! fp) {
+        perror(path);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), fp) && (num_events < MAX_EVENTS)) {
+        event_t *e = &events[num_events];
+        uint32_t ms;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = 0;
+        memset(e, 0, sizeof(*e));
+        if (sscanf(line, "%u %15s %15s %u", &ms, e->cmd, e->arg1, &e->arg2) < 2)
+            continue;
+        e->cycle = (uint64_t)ms * f_cpu / 1000;
+        num_events ++;
+    }
+    fclose(fp);
+}
+
+static void set_adc(avr_t *avr, const char *channel, uint32_t value) {
+    int irq;
+    if (! strcmp(channel, "temp")) irq = ADC_IRQ_TEMP;
+    else irq = ADC_IRQ_ADC0 + atoi(channel);
+    avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, irq), value);
+}
+
+static uint16_t get_sp(avr_t *avr) {
+    return avr->data[R_SPL] | (avr->data[R_SPH] << 8);
+}
+
+int main(int argc, char **argv) {
+    elf_firmware_t firmware;
+    avr_t *avr;
+    uint32_t f_cpu;
+    uint32_t loop_addr = 0;
+    uint32_t out_addr[4];
+    int num_outs = 0;
+    uint8_t *saved_ram;
+    stat_t loops = { "loop" };
+    stat_t boot = { "boot_to_output" };
+    stat_t latency = { "isr_latency" };
+    uint64_t base = 0, last = 0, now;
+    uint64_t loop_start = 0, boot_start = 0, pending_since = 0;
+    uint8_t loop_val = 0;
+    uint8_t peak = 0;
+    int booting = 1;
+    int next_event = 0;
+    int halted = 0;
+    int i, state;
+
+    if (argc < 5) {
+        fprintf(stderr, "usage: %s firmware.elf mcu f_cpu scenario.txt "
+                "[-f name=addr] [-v name=addr] [-l addr] [-o addr]\n", argv[0]);
+        return 1;
+    }
+    f_cpu = strtoul(argv[3], NULL, 0);
+    for (i = 5; i < argc - 1; i += 2) {
+        if (! strcmp(argv[i], "-f")) add_probe(funcs, &num_funcs, "", argv[i+1]);
+        else if (! strcmp(argv[i], "-v")) add_probe(vectors, &num_vectors, "isr_", argv[i+1]);
+        else if (! strcmp(argv[i], "-l")) loop_addr = strtoul(argv[i+1], NULL, 0);
+        else if (! strcmp(argv[i], "-o") && (num_outs < 4))
+            out_addr[num_outs++] = strtoul(argv[i+1], NULL, 0);
+    }
+    read_scenario(argv[4], f_cpu);
+
+    if (elf_read_firmware(argv[1], &firmware)) {
+        fprintf(stderr, "can't load %s\n", argv[1]);
+        return 1;
+    }
+    avr = avr_make_mcu_by_name(argv[2]);
+    if (! avr) {
+        fprintf(stderr, "unknown mcu %s\n", argv[2]);
+        return 1;
+    }
+    avr_init(avr);
+    avr->frequency = f_cpu;
+    avr->log = 0;
+    avr_load_firmware(avr, &firmware);
+    saved_ram = malloc(avr->ramend + 1);
+
+    while (1) {
+        state = avr_run(avr);
+        if (state == cpu_Crashed) break;
+        if (state == cpu_Done) {
+            // simavr stops when it sleeps with interrupts off
+            halted = ! avr->sreg[S_I];
+            break;
+        }
+
+        // avr_reset() may restart the cycle counter
+        if (avr->cycle < last) base += last;
+        last = avr->cycle;
+        now = base + avr->cycle;
+
+        // scripted stimulus
+        while ((next_event < num_events) && (now >= events[next_event].cycle)) {
+            event_t *e = &events[next_event++];
+            if (! strcmp(e->cmd, "end")) goto done;
+            if (! strcmp(e->cmd, "adc")) {
+                set_adc(avr, e->arg1, e->arg2);
+            } else if (! strcmp(e->cmd, "snap")) {
+                printf("snap %s %llu %u\n", e->arg1,
+                       (unsigned long long)(now * 1000 / f_cpu), peak);
+                peak = 0;
+            } else if ((! strcmp(e->cmd, "tap")) || (! strcmp(e->cmd, "off"))) {
+                int keep = ! strcmp(e->cmd, "tap");
+                int sram = avr->ioend + 1;
+                if (keep) memcpy(saved_ram, avr->data, avr->ramend + 1);
+                avr_reset(avr);
+                // SRAM holds its contents through a short power-off, but
+                // the registers and I/O still start from reset.  After a
+                // long one it's garbage.
+                if (keep) memcpy(avr->data + sram, saved_ram + sram,
+                                 avr->ramend + 1 - sram);
+                else for (int j = sram; j <= avr->ramend; j++)
+                    avr->data[j] = rand();
+                if (avr->cycle < last) base += last;
+                last = avr->cycle;
+                now = base + avr->cycle;
+                for (i = 0; i < num_funcs; i++) funcs[i].inside = 0;
+                booting = 1;
+                boot_start = now;
+                loop_start = 0;
+                pending_since = 0;
+            }
+        }
+
+        // time to first output, and the brightest it's been lately
+        for (i = 0; i < num_outs; i++) {
+            if (avr->data[out_addr[i]] > peak) peak = avr->data[out_addr[i]];
+            if (booting && avr->data[out_addr[i]]) {
+                stat_add(&boot, now - boot_start);
+                booting = 0;
+            }
+        }
+
+        // main loop iterations
+        if (loop_addr && (avr->data[loop_addr] != loop_val)) {
+            loop_val = avr->data[loop_addr];
+            if (loop_start) stat_add(&loops, now - loop_start);
+            loop_start = now;
+        }
+
+        // interrupt latency: from pending (and enabled) to the vector
+        if (! pending_since && avr->sreg[S_I] && avr_has_pending_interrupts(avr))
+            pending_since = now;
+        for (i = 0; i < num_vectors; i++) {
+            if (avr->pc == vectors[i].addr) {
+                stat_add(&vectors[i].stat, pending_since ? now - pending_since : 0);
+                if (pending_since) stat_add(&latency, now - pending_since);
+                pending_since = 0;
+            }
+        }
+
+        // function calls: entry by address, exit when SP goes back above
+        // where it was at entry (the return address has been popped)
+        for (i = 0; i < num_funcs; i++) {
+            probe_t *p = &funcs[i];
+            uint16_t sp = get_sp(avr);
+            if (p->inside) {
+                if (sp > p->sp) {
+                    stat_add(&p->stat, now - p->start);
+                    p->inside = 0;
+                }
+            } else if (avr->pc == p->addr) {
+                p->inside = 1;
+                p->sp = sp;
+                p->start = now;
+            }
+        }
+    }
+
+done:
+    for (i = 0; i < num_funcs; i++) stat_print(&funcs[i].stat);
+    for (i = 0; i < num_vectors; i++) stat_print(&vectors[i].stat);
+    if (num_vectors) stat_print(&latency);
+    if (loop_addr) stat_print(&loops);
+    if (num_outs) stat_print(&boot);
+    if (halted) {
+        printf("halt %llu\n", (unsigned long long)
+               ((base + avr->cycle) * 1000 / f_cpu));
+        for (i = 0x20; i <= avr->ioend; i++)
+            printf("io 0x%02x 0x%02x\n", i, avr->data[i]);
+    }
+    free(saved_ram);
+    return 0;
+}
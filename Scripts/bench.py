@@ -0,0 +1,294 @@
+#!/usr/bin/env python
+
+import os
+import sys
+import shutil
+import argparse
+import tempfile
+import subprocess
+
+
+here = os.path.dirname(os.path.abspath(__file__))
+top = os.path.dirname(here)
+baseline_file = os.path.join(here, 'bench_baseline.txt')
+
+# clock speed and output compare registers (data-space addresses) per MCU
+MCUS = {
+    'attiny13': (4800000, [0x49, 0x56]),  # OCR0B, OCR0A
+    'attiny25': (8000000, [0x48, 0x49]),  # OCR0B, OCR0A
+}
+
+# what to time in each firmware
+FUNCTIONS = {
+    'crescendo': ['set_level', 'save_mode', 'restore_state', 'battcheck',
+                  'read_adc_8bit', 'current_temperature'],
+    'bistro': ['set_mode', 'save_mode', 'restore_state', 'count_modes',
+               'battcheck', 'get_temperature'],
+    'biscotti': ['set_mode', 'save_mode', 'restore_state', 'count_modes',
+                 'battcheck'],
+}
+
+# scripted stimulus: "<ms> <command> [args]", see avr_bench.c
+# ADC inputs are mV at the pin, after the voltage divider, against the
+# 1.1V reference (tk-calibration.h: ADC_40 = 175/256, about 750 mV;
+# ADC_30 = 133/256, about 570 mV).  A cell at 4.0V visits battcheck and
+# then turbo (with crescendo's taps), then sags to 3.0V, under ADC_LOW,
+# long enough to step down to the bottom and shut off.
+SCENARIOS = {
+    'default': """
+        0 adc 1 750
+        0 adc 2 750
+        0 adc 3 750
+        0 adc temp 25000
+        300 tap
+        600 tap
+        900 tap
+        4000 off
+        4300 tap
+        4600 tap
+        6500 snap full
+        7000 adc 1 560
+        7000 adc 2 560
+        7000 adc 3 560
+        7000 adc temp 60000
+        10000 snap low
+        15000 snap low
+        20000 snap low
+        30000 snap low
+        60000 end
+    """,
+}
+
+
+def main(args):
+    """Cycle counts for firmware hot paths, under simavr.
+    Builds the firmware for the bench (-DBENCH), runs it in the simulator
+    with a scripted power / ADC sequence, and reports cycle counts for
+    each function, each main loop iteration, each interrupt's entry
+    latency, and the time from power-on to the first output.
+    Functions are timed in a second build with inlining turned off, since
+    most of them get inlined in a normal build.
+    Results are compared with Scripts/bench_baseline.txt, and anything
+    it doesn't cover is an error too, so a missing baseline can't pass.
+    Make one with --save from a known-good tree, and commit it.
+    The scenario has to actually reach a low-voltage step-down: the output
+    after its first "snap full" has to drop below that snap's peak at some
+    later snap (or the firmware shuts off), or the run fails.
+    """
+    parser = argparse.ArgumentParser(description=main.__doc__.split('\n')[0])
+    parser.add_argument('firmware', nargs='+',
+                        help='firmware name, like "crescendo"')
+    parser.add_argument('--mcu', default='attiny13', choices=sorted(MCUS))
+    parser.add_argument('--scenario', default='default',
+                        help='built-in scenario name, or a file')
+    parser.add_argument('--threshold', type=float, default=5.0,
+                        help='percent slower than baseline which counts as a regression')
+    parser.add_argument('--save', action='store_true',
+                        help='save these results as the new baseline')
+    opts = parser.parse_args(args)
+
+    for tool in ('avr-gcc', 'avr-nm', 'cc'):
+        if not shutil.which(tool):
+            print('ERROR: %s not found' % tool)
+            return 1
+
+    work = tempfile.mkdtemp(prefix='bench-')
+    try:
+        harness = build_harness(work)
+        if not harness:
+            return 1
+        if opts.scenario in SCENARIOS:
+            text = SCENARIOS[opts.scenario]
+        else:
+            text = open(opts.scenario).read()
+        scenario = os.path.join(work, 'scenario.txt')
+        with open(scenario, 'w') as fp:
+            fp.write('\n'.join(l.strip() for l in text.splitlines()) + '\n')
+
+        results = {}
+        for fw in opts.firmware:
+            r = bench(fw, opts.mcu, harness, scenario, work)
+            if r is None:
+                return 1
+            results.update(r)
+    finally:
+        shutil.rmtree(work)
+
+    baseline = load(baseline_file)
+    regressions = report(results, baseline, opts.threshold)
+    missing = [name for name in results if name not in baseline]
+
+    if opts.save:
+        baseline.update(results)
+        save(baseline_file, baseline)
+        print('Saved %s' % baseline_file)
+    elif regressions:
+        print('ERROR: %i regression(s) over %g%%' %
+              (regressions, opts.threshold))
+        return 1
+    elif missing:
+        print('ERROR: %i result(s) have no baseline in %s' %
+              (len(missing), baseline_file))
+        print('(run with --save on a known-good tree, and commit it)')
+        return 1
+
+    return 0
+
+
+def build_harness(work):
+    out = os.path.join(work, 'avr_bench')
+    cmd = ['cc', '-O2', '-o', out, os.path.join(here, 'avr_bench.c'),
+           '-lsimavr', '-lelf']
+    if subprocess.call(cmd):
+        print('ERROR: could not build avr_bench.c (is simavr installed?)')
+        return None
+    return out
+
+
+def build(fw, mcu, work, extra):
+    """Build a copy of the firmware, so the tree stays clean"""
+    src = os.path.join(work, '%s-%s' % (fw, len(extra)))
+    skip = shutil.ignore_patterns('.git', 'Scripts', '*.whl', '_*build*')
+    shutil.copytree(top, src, ignore=skip)
+    env = dict(os.environ)
+    env['EXTRA_CFLAGS'] = ' '.join(['-DBENCH'] + extra)
+    attiny = mcu.replace('attiny', '')
+    with open(os.devnull, 'w') as null:
+        # build.sh always uses attiny13; swap it for the requested one
+        script = open(os.path.join(src, 'build.sh')).read()
+        script = script.replace('ATTINY=13', 'ATTINY=%s' % attiny)
+        with open(os.path.join(src, 'build.sh'), 'w') as fp:
+            fp.write(script)
+        if subprocess.call(['bash', './build.sh', fw], cwd=src,
+                           stdout=null, env=env):
+            print('ERROR: %s did not build' % fw)
+            return None
+    return os.path.join(src, fw + '.elf')
+
+
+def symbols(elf):
+    """Name -> address; RAM addresses are made relative to data space"""
+    out = subprocess.check_output(['avr-nm', elf]).decode()
+    syms = {}
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) != 3:
+            continue
+        addr, kind, name = int(parts[0], 16), parts[1], parts[2]
+        if kind.lower() in 'bd':
+            addr &= 0xffff
+        syms[name] = addr
+    return syms
+
+
+def run(harness, elf, mcu, scenario, probes):
+    f_cpu, _ = MCUS[mcu]
+    cmd = [harness, elf, mcu, str(f_cpu), scenario] + probes
+    out = subprocess.check_output(cmd).decode()
+    results = {}
+    snaps = []
+    halt = None
+    for line in out.splitlines():
+        parts = line.split()
+        if parts[:1] == ['snap']:
+            snaps.append((parts[1], int(parts[3])))
+        elif parts[:1] == ['halt']:
+            halt = int(parts[1])
+        elif len(parts) == 5:
+            results[parts[0]] = [int(x) for x in parts[1:]]
+    return results, snaps, halt
+
+
+def stepped_down(snaps, halt):
+    """Did the output drop, after the "full" snap, below that snap's peak?"""
+    names = [name for name, peak in snaps]
+    if 'full' not in names:
+        # a custom scenario which doesn't check for it
+        return True
+    full = snaps[names.index('full')][1]
+    later = [peak for name, peak in snaps[names.index('full') + 1:]]
+    if halt is not None:
+        later.append(0)
+    return bool(full) and any(peak < full for peak in later)
+
+
+def bench(fw, mcu, harness, scenario, work):
+    _, outputs = MCUS[mcu]
+    results = {}
+
+    # normal build: loop, interrupts, boot
+    elf = build(fw, mcu, work, [])
+    if not elf:
+        return None
+    syms = symbols(elf)
+    probes = []
+    if 'bench_loops' in syms:
+        probes += ['-l', hex(syms['bench_loops'])]
+    for name in sorted(syms):
+        if name.startswith('__vector_'):
+            probes += ['-v', '%s=%s' % (name[2:], hex(syms[name]))]
+    for addr in outputs:
+        probes += ['-o', hex(addr)]
+    r, snaps, halt = run(harness, elf, mcu, scenario, probes)
+    for name, r in r.items():
+        results['%s.%s' % (fw, name)] = r
+    if not stepped_down(snaps, halt):
+        print('ERROR: %s never stepped down for low voltage '
+              '(snaps: %s, halt: %s)' % (fw, snaps, halt))
+        return None
+
+    # no-inline build: per-function counts
+    elf = build(fw, mcu, work, ['-fno-inline'])
+    if not elf:
+        return None
+    syms = symbols(elf)
+    probes = []
+    for name in FUNCTIONS.get(fw, []):
+        if name in syms:
+            probes += ['-f', '%s=%s' % (name, hex(syms[name]))]
+        else:
+            print('(%s: %s is not in this build)' % (fw, name))
+    if probes:
+        for name, r in run(harness, elf, mcu, scenario, probes)[0].items():
+            results['%s.%s' % (fw, name)] = r
+
+    return results
+
+
+def report(results, baseline, threshold):
+    """Print results, and count the averages which got slower"""
+    regressions = 0
+    print('%-32s %7s %9s %9s %9s  %s' %
+          ('metric', 'count', 'min', 'avg', 'max', 'vs baseline'))
+    for name in sorted(results):
+        count, lo, avg, hi = results[name]
+        change = 'no baseline'
+        if name in baseline and baseline[name][2]:
+            pct = (avg - baseline[name][2]) * 100.0 / baseline[name][2]
+            change = '%+.1f%%' % pct
+            if pct > threshold:
+                change += '  REGRESSION'
+                regressions += 1
+        print('%-32s %7i %9i %9i %9i  %s' % (name, count, lo, avg, hi, change))
+    return regressions
+
+
+def load(path):
+    baseline = {}
+    if os.path.exists(path):
+        for line in open(path):
+            parts = line.split()
+            if len(parts) == 5 and not line.startswith('#'):
+                baseline[parts[0]] = [int(x) for x in parts[1:]]
+    return baseline
+
+
+def save(path, baseline):
+    with open(path, 'w') as fp:
+        fp.write('# metric count min avg max (cycles), from Scripts/bench.py --save\n')
+        for name in sorted(baseline):
+            fp.write('%s %s\n' % (name, ' '.join(str(x) for x in baseline[name])))
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,337 @@
+#!/usr/bin/env python
+
+import os
+import re
+import sys
+import argparse
+
+
+here = os.path.dirname(os.path.abspath(__file__))
+top = os.path.dirname(here)
+
+# EEPROM size per MCU
+EEPSIZE = {
+    'attiny13': 64,
+    'attiny25': 128,
+    'attiny45': 256,
+    'attiny85': 512,
+}
+
+# where each firmware keeps its wear-leveled mode memory:
+# (cells used, as a function of EEPSIZE; what each record holds; whether
+#  it trusts every saved option once it finds a mode, so options left out
+#  of the config need the firmware's defaults instead of 0xff)
+# (the OPT_* addresses are read from the .c file itself)
+FIRMWARES = {
+    'bistro': (lambda size: size // 2, ['mode'], True),
+    'biscotti': (lambda size: size // 2, ['mode'], True),
+    # EEP_WEAR_LVL_LEN
+    'crescendo': (lambda size: min(size // 2, 128), ['mode', 'level'], False),
+}
+
+# values which are easier to write in other units
+CHEMISTRIES = {'liion': 0, 'lifepo4': 1, 'nimh3': 2}
+ENCODE = {
+    'vbg': lambda v: int(v) - 1000,  # mV
+    'chem': lambda v: CHEMISTRIES[v.lower()] if v.lower() in CHEMISTRIES else int(v, 0),
+}
+
+
+def main(args):
+    """Builds a preconfigured EEPROM image (.eep) for a firmware.
+    So a light can come off the programmer already set up, instead of
+    being configured by hand through its blinky menus.  The config file
+    has one "name = value" per line, where name is any OPT_* option the
+    firmware has (without the OPT_), or one of:
+        mode       mode index to start in (written into the wear-leveled
+                   memory, which also tells bistro and biscotti that the
+                   light has been set up already)
+        level      ramp level to start at (crescendo only)
+        eepos      which wear-leveling cell to use, to spread the wear
+                   out across a batch of lights
+        firstboot  "yes" to leave the first-boot marker and the mode
+                   memory blank, so the firmware runs its first-boot setup
+    A value can be a list of bytes, for options which take more than one,
+    like "tempcal = 12 140 255".  vbg is in mV, and chem can be a name.
+    Options which the firmware doesn't have are an error, so a typo can't
+    quietly leave a light unconfigured.  Addresses come from the OPT_*
+    #defines in the firmware's .c file, so they always match it.
+    Which options it has depends on how it's built, so the .c file (and
+    the headers it includes) goes through the #ifdef / #if blocks first,
+    for the chosen --mcu, with its own #defines plus any -D / -U given
+    here (the same ones as in EXTRA_CFLAGS for build.sh).  An option
+    only counts if its #define survives that and the firmware uses it.
+    Example (crescendo, with -D MEMTOGGLE -D VOLTAGE_BANDGAP --mcu attiny25):
+        memory = 1
+        therm_ceil = 55
+        vbg = 1087
+    Flash the result with: ./flash.sh attiny25 crescendo.hex crescendo.eep
+    """
+    parser = argparse.ArgumentParser(description=main.__doc__.split('\n')[0])
+    parser.add_argument('firmware', choices=sorted(FIRMWARES))
+    parser.add_argument('config', nargs='?', help='config file')
+    parser.add_argument('--set', action='append', default=[], metavar='NAME=VALUE',
+                        help='set a value (after the config file), like per-unit calibration')
+    parser.add_argument('--mcu', default='attiny13', choices=sorted(EEPSIZE))
+    parser.add_argument('-D', '--define', action='append', default=[], metavar='NAME[=VALUE]',
+                        help='build option to turn on, like -D MEMTOGGLE')
+    parser.add_argument('-U', '--undef', action='append', default=[], metavar='NAME',
+                        help='build option to turn off, like -U VOLTAGE_MON')
+    parser.add_argument('-o', '--output', help='output file (default: <firmware>.eep)')
+    opts = parser.parse_args(args)
+
+    size = EEPSIZE[opts.mcu]
+    wear_len, record, trusting = FIRMWARES[opts.firmware]
+    wear_len = wear_len(size)
+    forced = {'ATTINY': opts.mcu[len('attiny'):]}
+    for d in opts.define:
+        name, _, value = d.partition('=')
+        forced[name.strip()] = value.strip() or '1'
+    for name in opts.undef:
+        forced[name.strip()] = None
+    try:
+        source, errors = preprocess(opts.firmware + '.c', forced)
+    except ValueError as e:
+        print('ERROR: %s' % e)
+        return 1
+    if errors:
+        for e in errors:
+            print('ERROR: %s' % e)
+        return 1
+    options, firstboot = layout(source, size, wear_len)
+
+    settings = []
+    if opts.config:
+        for num, line in enumerate(open(opts.config)):
+            line = line.split('#')[0].strip()
+            if not line:
+                continue
+            if '=' not in line:
+                print('ERROR: %s:%i: expected "name = value"' % (opts.config, num + 1))
+                return 1
+            settings.append([x.strip() for x in line.split('=', 1)])
+    for s in opts.set:
+        if '=' not in s:
+            print('ERROR: --set %s: expected NAME=VALUE' % s)
+            return 1
+        settings.append([x.strip() for x in s.split('=', 1)])
+
+    values = {}
+    for name, value in settings:
+        if name == 'firstboot':
+            values[name] = value.lower() in ('yes', '1', 'true')
+            continue
+        if name not in options and name not in record + ['eepos']:
+            print('ERROR: %s has no option "%s" in this build (it has: %s)' %
+                  (opts.firmware, name, ', '.join(sorted(options) + record + ['eepos'])))
+            return 1
+        try:
+            encode = ENCODE.get(name, lambda v: int(v, 0))
+            values[name] = [encode(v) for v in value.split()]
+        except (ValueError, KeyError):
+            print('ERROR: bad value for %s: "%s"' % (name, value))
+            return 1
+        for v in values[name]:
+            if not 0 <= v <= 255:
+                print('ERROR: %s = %s is out of range for a byte' % (name, value))
+                return 1
+
+    image = [0xff] * size
+    written = []
+
+    def put(addr, byte, name):
+        if addr in [w[0] for w in written]:
+            print('ERROR: %s overlaps another value at address %i' % (name, addr))
+            return False
+        image[addr] = byte
+        written.append((addr, byte, name))
+        return True
+
+    fresh = values.pop('firstboot', False)
+    eepos = values.pop('eepos', [0])[0]
+    wear = [values.pop(r, [None])[0] for r in record]
+    if eepos % len(record) or eepos + len(record) > wear_len:
+        print('ERROR: eepos %i is not a record in the %i-byte wear-leveling area' %
+              (eepos, wear_len))
+        return 1
+    if not fresh:
+        if firstboot is not None:
+            if not put(options.pop('firstboot'), firstboot, 'firstboot'):
+                return 1
+        # bistro and biscotti only find the other options if memory has a mode
+        if wear[0] is None and opts.firmware != 'crescendo':
+            wear[0] = 0
+        for i, (name, byte) in enumerate(zip(record, wear)):
+            if byte is not None and not put(eepos + i, byte, name):
+                return 1
+
+        if trusting:
+            for name, byte in defaults(source).items():
+                if name in options and name not in values:
+                    values[name] = [byte]
+
+    for name in sorted(values, key=lambda n: options[n]):
+        for i, byte in enumerate(values[name]):
+            addr = options[name] + i
+            if addr < wear_len or addr >= size:
+                print('ERROR: %s does not fit at address %i' % (name, addr))
+                return 1
+            if not put(addr, byte, name):
+                return 1
+
+    output = opts.output or (opts.firmware + '.eep')
+    with open(output, 'w') as fp:
+        fp.write(ihex(image))
+    for addr, byte, name in sorted(written):
+        print('%4i: %3i  %s' % (addr, byte, name))
+    print('Wrote %s (%s, %i bytes)' % (output, opts.mcu, size))
+    return 0
+
+
+def layout(source, size, wear_len):
+    """OPT_* name -> address, and the first-boot marker (or None)"""
+    bases = {'EEPSIZE': size, 'EEP_WEAR_LVL_LEN': wear_len}
+    options = {}
+    for m in re.finditer(r'^#define OPT_(\w+)\s+\((\w+)\s*([-+])\s*(\d+)\)',
+                         source, re.M):
+        name, base, sign, offset = m.groups()
+        # defined, but nothing reads it in this build
+        if len(re.findall(r'\bOPT_%s\b' % name, source)) < 2:
+            continue
+        offset = int(offset) if sign == '+' else -int(offset)
+        options[name] = bases[base] + offset
+    firstboot = None
+    if re.search(r'^#define USE_FIRSTBOOT\b', source, re.M):
+        m = re.search(r'^#\s*define FIRSTBOOT\s+(\w+)', source, re.M)
+        firstboot = int(m.group(1), 0)
+    else:
+        options.pop('firstboot', None)
+    return options, firstboot
+
+
+def defaults(source):
+    """OPT_* name -> initial value of the variable save_state() saves there"""
+    result = {}
+    for m in re.finditer(r'eeprom_write_byte\(\(uint8_t \*\)OPT_(\w+), (\w+)\)',
+                         source):
+        name, var = m.groups()
+        init = re.search(r'^uint8_t %s\s*(=\s*(\w+))?;' % var, source, re.M)
+        if not init:
+            continue
+        value = (init.group(2) or '0').rstrip('uU')
+        macro = re.search(r'^#\s*define %s\s+(\w+)' % value, source, re.M)
+        if macro:
+            value = macro.group(1).rstrip('uU')
+        result[name] = int(value, 0)
+    return result
+
+
+def preprocess(filename, forced):
+    """The lines of a firmware (and its local #includes) which are left
+    after #ifdef / #if, without comments, plus any "Hey, ..." errors it
+    runs into.  forced holds -D / -U values: these win over the source's
+    own #define / #undef (None means undefined)."""
+    macros = dict((k, v) for k, v in forced.items() if v is not None)
+    live = []
+    errors = []
+
+    def expand(expr):
+        expr = re.sub(r'\bdefined\s*\(\s*(\w+)\s*\)|\bdefined\s+(\w+)',
+                      lambda m: '1' if (m.group(1) or m.group(2)) in macros else '0',
+                      expr)
+        for _ in range(32):
+            new = re.sub(r'\b[A-Za-z_]\w*\b',
+                         lambda m: '(%s)' % macros[m.group(0)]
+                         if macros.get(m.group(0)) not in (None, '') else m.group(0),
+                         expr)
+            if new == expr:
+                break
+            expr = new
+        return expr
+
+    def evaluate(expr, where):
+        expr = expand(expr)
+        expr = re.sub(r'\b(0[xX][0-9a-fA-F]+|0[bB][01]+|\d+)[uUlL]*\b',
+                      lambda m: str(int(m.group(1), 0) if not re.match(r'0\d', m.group(1))
+                                    else int(m.group(1), 8)),
+                      expr)
+        # anything still a name isn't a macro, which counts as 0 in C
+        expr = re.sub(r'\b[A-Za-z_]\w*\b', '0', expr)
+        expr = expr.replace('&&', ' and ').replace('||', ' or ').replace('/', '//')
+        expr = re.sub(r'!(?!=)', ' not ', expr)
+        try:
+            return bool(eval(expr, {'__builtins__': {}}))
+        except Exception:
+            raise ValueError('%s: can\'t evaluate "#if %s"' % (where, expr))
+
+    def run(name, seen):
+        path = os.path.join(top, name)
+        text = open(path).read()
+        text = re.sub(r'\\\n', '', text)
+        text = re.sub(r'/\*.*?\*/', lambda m: '\n' * m.group(0).count('\n'), text, flags=re.S)
+        # each level: (taking this branch, some branch was taken, parent live)
+        stack = []
+        on = True
+        for num, line in enumerate(text.split('\n')):
+            where = '%s:%i' % (name, num + 1)
+            line = re.sub(r'//.*', '', line).rstrip()
+            m = re.match(r'\s*#\s*(\w+)\s*(.*)', line)
+            word, rest = m.groups() if m else (None, '')
+            if word in ('ifdef', 'ifndef', 'if'):
+                if word == 'if':
+                    taken = on and evaluate(rest, where)
+                else:
+                    taken = on and ((rest.split()[0] in macros) == (word == 'ifdef'))
+                stack.append((taken, taken, on))
+                on = taken
+            elif word == 'elif':
+                _, done, parent = stack.pop()
+                taken = parent and not done and evaluate(rest, where)
+                stack.append((taken, done or taken, parent))
+                on = taken
+            elif word == 'else':
+                _, done, parent = stack.pop()
+                stack.append((parent and not done, True, parent))
+                on = parent and not done
+            elif word == 'endif':
+                on = stack.pop()[2]
+            elif not on:
+                continue
+            elif word == 'define':
+                m = re.match(r'(\w+)(\([^)]*\))?\s*(.*)', rest)
+                if m.group(1) not in forced:
+                    # function-like macros are only good for defined()
+                    macros[m.group(1)] = '' if m.group(2) else m.group(3).strip()
+                live.append(line.strip())
+            elif word == 'undef':
+                if rest.split()[0] not in forced:
+                    macros.pop(rest.split()[0], None)
+            elif word == 'include':
+                m = re.match(r'"([^"]+)"', rest)
+                if m and os.path.exists(os.path.join(top, m.group(1))) and m.group(1) not in seen:
+                    run(m.group(1), seen | set([m.group(1)]))
+            elif line.strip().startswith('Hey,'):
+                errors.append('%s: %s' % (where, line.strip()))
+            else:
+                live.append(line)
+        if stack:
+            raise ValueError('%s: unterminated #if' % name)
+
+    run(filename, set([filename]))
+    return '\n'.join(live), errors
+
+
+def ihex(image):
+    """Intel HEX, like avr-objcopy makes for .eep files"""
+    lines = []
+    for addr in range(0, len(image), 16):
+        data = image[addr:addr + 16]
+        rec = [len(data), addr >> 8, addr & 0xff, 0] + data
+        lines.append(':%s%02X' % (''.join('%02X' % b for b in rec),
+                                  -sum(rec) & 0xff))
+    lines.append(':00000001FF')
+    return '\n'.join(lines) + '\n'
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -1,5 +1,7 @@
 #!/usr/bin/env python
 
+import re
+import csv
 import math
 
 interactive = False
@@ -142,6 +144,234 @@ def multi_pwm(answers, channels):
                ','.join([str(int(round(i))) for i in channel.modes])))
 
 
+def fit_main(args):
+    """Calculates PWM levels from measured output.
+    Usage: level_calc.py --fit measured.csv num_levels [lm_min]
+    The CSV has one row per measurement: channel,pwm,lumens
+    Measure each channel with every lower channel at 255 (like the ramp
+    uses them), in order of lowest to highest power, and include pwm 255.
+    The table is inverted by interpolation, so non-linear drivers and
+    dead zones at the bottom come out right without hand-tuning.
+    Output is crescendo's RAMP_CH1, RAMP_CH2... (RAMP_SIZE comes from
+    those).  Channels named ch1, ch2, ch3 in the CSV keep those numbers,
+    for drivers where RAMP_CH1 isn't the lowest-power channel (like
+    tripledown, where it's the 6x7135 bank); other names are numbered in
+    the order they're measured.  Levels which measure no brighter than
+    the one before are dropped, so the ramp may come out shorter.
+    """
+    if len(args) < 2:
+        print(fit_main.__doc__)
+        return 1
+    try:
+        num_levels = int(args[1])
+        lm_min = float(args[2]) if len(args) > 2 else None
+    except ValueError:
+        print('ERROR: num_levels and lm_min should be numbers')
+        return 1
+    if not (1 <= num_levels <= 255):
+        print('ERROR: ramp levels are one byte, so 1 to 255 of them, not %i' %
+              (num_levels))
+        return 1
+    try:
+        channels = read_measurements(args[0])
+    except (IOError, ValueError) as e:
+        print('ERROR: %s' % e)
+        return 1
+
+    # lowest PWM which makes any light at all
+    first = channels[0]
+    lit = [p for p, lm in first.points if lm > 0]
+    if not lit:
+        print('ERROR: channel %s never makes any light' % first.name)
+        return 1
+    pwm_min = min(lit)
+    bottom = interp(pwm_min, first.pwms, first.lms)
+    if lm_min is None:
+        lm_min = bottom
+    if lm_min < bottom:
+        print('ERROR: can\'t go below %.3f lm (pwm %i)' % (bottom, pwm_min))
+        return 1
+    lm_max = channels[-1].lms[-1]
+
+    # perceptually even goals, inverted to fractional ramp positions
+    # (position = channel * 256 + pwm, with lower channels at 255)
+    visual_min = invpower(lm_min)
+    visual_max = invpower(lm_max)
+    goals = []
+    positions = []
+    for i in range(num_levels):
+        frac = float(i) / max(1, num_levels - 1)
+        goal_lm = power(visual_min + (frac * (visual_max - visual_min)))
+        goals.append(goal_lm)
+        positions.append(invert(channels, goal_lm))
+
+    # round, and make sure every level is brighter than the one before
+    lowest = pwm_min
+    highest = ((len(channels) - 1) * 256) + 255
+    ramp = []
+    for pos in positions:
+        pos = int(round(pos))
+        if (pos % 256) == 0 and pos > 0:
+            pos += 1  # pwm 0 on a channel is the same as 255 on the last
+        if ramp:
+            pos = max(pos, next_pos(ramp[-1]))
+        ramp.append(max(lowest, pos))
+    ramp[-1] = highest
+    for i in range(len(ramp) - 2, -1, -1):
+        if ramp[i] >= ramp[i + 1]:
+            ramp[i] = prev_pos(ramp[i + 1])
+    if ramp[0] < lowest:
+        print('ERROR: %i levels don\'t fit between pwm %i and turbo' %
+              (num_levels, pwm_min))
+        return 1
+
+    # different PWM doesn't always mean more light (flat spots, or the
+    # next channel's lowest step), so drop levels which aren't brighter
+    kept, kept_goals = [], []
+    for i, pos in enumerate(ramp):
+        lm = measured_lm(channels, pos)
+        while kept and lm <= measured_lm(channels, kept[-1]):
+            if i < len(ramp) - 1:
+                break
+            # never drop turbo; drop what's under it instead
+            kept.pop()
+            kept_goals.pop()
+        if kept and lm <= measured_lm(channels, kept[-1]):
+            continue
+        kept.append(pos)
+        kept_goals.append(goals[i])
+    if len(kept) < len(ramp):
+        print('NOTE: dropped %i level(s) which measure no brighter than the '
+              'one before, so there are %i' % (len(ramp) - len(kept), len(kept)))
+    ramp, goals = kept, kept_goals
+
+    # Show individual levels in detail
+    for i, pos in enumerate(ramp):
+        pwms = channel_pwms(channels, pos)
+        actual = measured_lm(channels, pos)
+        print('%i: visually %.2f (%.2f lm, fit %.2f lm): %s' %
+              (i + 1, invpower(goals[i]), goals[i], actual,
+               ', '.join('%i/255' % p for p in pwms)))
+
+    # Show values we can paste into source code
+    print('// level_calc.py --fit %s' % (' '.join(str(a) for a in args)))
+    print('// %i levels; %s' % (len(ramp), ', '.join(
+        'RAMP_%s is "%s"' % (c.macro, c.name) for c in channels)))
+    for cnum, channel in sorted(enumerate(channels), key=lambda c: c[1].macro):
+        print('#define RAMP_%s  %s' %
+              (channel.macro,
+               ','.join(str(channel_pwms(channels, pos)[cnum])
+                        for pos in ramp)))
+
+    return 0
+
+
+def read_measurements(path):
+    """Load channel,pwm,lumens rows, keeping the channel order"""
+    channels = []
+    by_name = {}
+    with open(path) as fp:
+        for row in csv.reader(fp):
+            if (not row) or row[0].strip().startswith('#'):
+                continue
+            try:
+                name, pwm, lm = row[0].strip(), int(row[1]), float(row[2])
+            except (ValueError, IndexError):
+                continue  # header line
+            if name not in by_name:
+                chan = Empty()
+                chan.name = name
+                chan.points = []
+                by_name[name] = chan
+                channels.append(chan)
+            by_name[name].points.append((pwm, lm))
+
+    if not channels:
+        raise ValueError('%s has no channel,pwm,lumens rows' % path)
+    numbered = set()
+    for chan in channels:
+        m = re.match(r'^ch([1-9])$', chan.name.lower())
+        if m:
+            chan.macro = 'CH%s' % m.group(1)
+            numbered.add(chan.macro)
+    for cnum, chan in enumerate(channels):
+        chan.points.sort()
+        if chan.points[-1][0] > 255 or chan.points[0][0] < 0:
+            raise ValueError('channel %s has a pwm outside 0 to 255' %
+                             (chan.name))
+        if chan.points[-1][0] != 255:
+            raise ValueError('channel %s needs a measurement at pwm 255' %
+                             (chan.name))
+        # light meters are noisy; output can't go down when pwm goes up
+        chan.pwms = []
+        chan.lms = []
+        top = 0.0
+        for pwm, lm in chan.points:
+            top = max(top, lm)
+            chan.pwms.append(pwm)
+            chan.lms.append(top)
+        if not hasattr(chan, 'macro'):
+            chan.macro = 'CH%i' % (cnum + 1)
+            if chan.macro in numbered:
+                raise ValueError('channel %s would be RAMP_%s, but so is '
+                                 'another one' % (chan.name, chan.macro))
+    return channels
+
+
+def interp(x, xs, ys):
+    """Linear interpolation of y at x, clamped to the ends"""
+    if x <= xs[0]:
+        return ys[0]
+    for i in range(1, len(xs)):
+        if x <= xs[i]:
+            if xs[i] == xs[i - 1]:
+                return ys[i]
+            t = float(x - xs[i - 1]) / (xs[i] - xs[i - 1])
+            return ys[i - 1] + (t * (ys[i] - ys[i - 1]))
+    return ys[-1]
+
+
+def invert(channels, goal_lm):
+    """Fractional ramp position which gives goal_lm"""
+    for cnum, chan in enumerate(channels):
+        if goal_lm <= chan.lms[-1]:
+            # pwm for this lumen value, using the first pwm on flat parts
+            for i in range(1, len(chan.lms)):
+                if goal_lm <= chan.lms[i] and chan.lms[i] > chan.lms[i - 1]:
+                    t = (goal_lm - chan.lms[i - 1]) / (chan.lms[i] - chan.lms[i - 1])
+                    pwm = chan.pwms[i - 1] + (t * (chan.pwms[i] - chan.pwms[i - 1]))
+                    return (cnum * 256) + max(0.0, pwm)
+            return (cnum * 256) + chan.pwms[0]
+    return ((len(channels) - 1) * 256) + 255
+
+
+def next_pos(pos):
+    pos += 1
+    if (pos % 256) == 0:
+        pos += 1
+    return pos
+
+
+def prev_pos(pos):
+    pos -= 1
+    if (pos % 256) == 0 and pos > 0:
+        pos -= 1
+    return pos
+
+
+def channel_pwms(channels, pos):
+    """PWM value for each channel at a ramp position"""
+    cnum, pwm = divmod(pos, 256)
+    return [255 if c < cnum else (pwm if c == cnum else 0)
+            for c in range(len(channels))]
+
+
+def measured_lm(channels, pos):
+    cnum, pwm = divmod(pos, 256)
+    chan = channels[cnum]
+    return interp(pwm, chan.pwms, chan.lms)
+
+
 def get_value(text, default, args):
     """Get input from the user, or from the command line args."""
     if args:
@@ -174,5 +404,7 @@ def invpower(x):
 
 if __name__ == "__main__":
     import sys
+    if sys.argv[1:2] == ['--fit']:
+        sys.exit(fit_main(sys.argv[2:]))
     # main(sys.argv[1:])
     main([1, 2 * 64, 7135, 14, 0.25, 1000])
@@ -0,0 +1,113 @@
+#!/usr/bin/env python
+
+import sys
+import math
+import argparse
+
+
+ADC_MAX = 1023     # 10-bit ADC
+SAMPLES = 8        # tk-ntc.h adds up this many readings
+SUM_MAX = ADC_MAX * SAMPLES
+MAX_ENTRIES = 32   # keep the table small for attiny13
+KELVIN = 273.15
+
+
+def main(args):
+    """Make the NTC thermistor lookup table for tk-ntc.h
+    The thermistor goes from the ADC pin to ground, with a fixed resistor
+    from VCC to the pin, and the ADC uses VCC as its reference, so the
+    reading only depends on the resistances.  The table is spaced evenly
+    in ADC units (so the firmware can interpolate with shifts instead of
+    division), and holds whole degrees C.  Paste the output into
+    tk-calibration.h.
+    """
+    parser = argparse.ArgumentParser(description=main.__doc__.split('\n')[0])
+    parser.add_argument('--r25', type=float, default=100000,
+                        help='thermistor resistance at 25 C, ohms')
+    parser.add_argument('--beta', type=float, default=3950,
+                        help='thermistor B value (B25/50)')
+    parser.add_argument('--rfixed', type=float, default=22000,
+                        help='fixed resistor from VCC to the ADC pin, ohms')
+    parser.add_argument('--tmin', type=float, default=0,
+                        help='coldest temperature to cover, C')
+    parser.add_argument('--tmax', type=float, default=120,
+                        help='hottest temperature to cover, C')
+    parser.add_argument('-v', '--verbose', action='store_true',
+                        help='show the error over the whole range')
+    opts = parser.parse_args(args)
+
+    if not (0 <= opts.tmin < opts.tmax <= 255):
+        print('ERROR: need 0 <= tmin < tmax <= 255')
+        return 1
+
+    def adc_sum(c):
+        r = resistance(opts, c)
+        return SUM_MAX * r / (r + opts.rfixed)
+
+    # hotter is lower, since the thermistor pulls the pin down
+    lo = int(adc_sum(opts.tmax))
+    hi = int(math.ceil(adc_sum(opts.tmin)))
+    shift = 2  # the firmware needs at least 2 for 13.2 fixed-point
+    while ((hi - lo) >> shift) >= (MAX_ENTRIES - 1):
+        shift += 1
+    entries = ((hi - lo) >> shift) + 2
+    table = []
+    for i in range(entries):
+        s = min(lo + (i << shift), SUM_MAX)
+        table.append(int(round(min(max(temperature(opts, s), 0), 255))))
+
+    # check the firmware's math against the real curve
+    worst = 0.0
+    for c in range(int(opts.tmin), int(opts.tmax) + 1):
+        got = firmware(table, lo, shift, int(adc_sum(c))) / 4.0
+        worst = max(worst, abs(got - c))
+        if opts.verbose:
+            print('// %3i C -> %6.2f C' % (c, got))
+    counts = (adc_sum(60) - adc_sum(61)) / SAMPLES
+
+    print('// Scripts/ntc_calc.py --r25 %g --beta %g --rfixed %g --tmin %g --tmax %g' %
+          (opts.r25, opts.beta, opts.rfixed, opts.tmin, opts.tmax))
+    print('// %i entries, worst error %.2f C, %.1f ADC counts per C at 60 C' %
+          (entries, worst, counts))
+    print('#define NTC_SUM_MIN %i' % lo)
+    print('#define NTC_SHIFT %i' % shift)
+    print('#define NTC_TABLE %s' % ','.join(str(t) for t in table))
+
+    steepest = max(abs(a - b) for a, b in zip(table, table[1:]))
+    if (steepest << shift) > 32767:
+        print('ERROR: table is too steep for 16-bit interpolation; narrow the range')
+        return 1
+    if counts < 1.0:
+        print('ERROR: less than one ADC count per degree; pick rfixed near the thermistor resistance at the ceiling')
+        return 1
+    return 0
+
+
+def resistance(opts, c):
+    """Beta model"""
+    return opts.r25 * math.exp(opts.beta * (1.0 / (c + KELVIN) - 1.0 / (25 + KELVIN)))
+
+
+def temperature(opts, s):
+    """Inverse of the divider + Beta model, for an ADC sum"""
+    if s <= 0:
+        return 255
+    if s >= SUM_MAX:
+        return 0
+    r = opts.rfixed * s / (SUM_MAX - s)
+    return 1.0 / (math.log(r / opts.r25) / opts.beta + 1.0 / (25 + KELVIN)) - KELVIN
+
+
+def firmware(table, lo, shift, s):
+    """Same integer math as ntc_temperature(), in 13.2 fixed-point"""
+    s = max(s, lo) - lo
+    i = s >> shift
+    if i >= len(table) - 1:
+        return table[-1] << 2
+    frac = s & ((1 << shift) - 1)
+    d = table[i + 1] - table[i]
+    return (table[i] << 2) + ((d * frac) >> (shift - 2))
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,345 @@
+#!/usr/bin/env python
+
+import os
+import re
+import sys
+import argparse
+import multiprocessing
+
+import numpy as np
+
+
+# same model constants as sim.py
+ROOM_TEMP = 22
+RAMP_7135 = [4, 4, 5, 5, 5, 6, 6, 7, 8, 8, 9, 10, 11, 12, 13, 14, 15, 17, 18, 20, 22, 23, 25, 27, 30, 32, 34, 37, 40, 42, 45, 48, 52, 55, 59, 62, 66, 70, 74, 79, 83, 88, 93, 98, 104, 109, 115, 121, 127, 133, 140, 146, 153, 160, 168, 175, 183, 191, 200, 208, 217, 226, 236, 245]
+RAMP_FET = [0, 2, 3, 4, 5, 7, 8, 9, 11, 12, 14, 15, 17, 18, 20, 22, 23, 25, 27, 29, 30, 32, 34, 36, 38, 40, 42, 44, 47, 49, 51, 53, 56, 58, 60, 63, 66, 68, 71, 73, 76, 79, 82, 85, 87, 90, 93, 96, 100, 103, 106, 109, 113, 116, 119, 123, 126, 130, 134, 137, 141, 145, 149, 153, 157, 161, 165, 169, 173, 178, 182, 186, 191, 196, 200, 205, 210, 214, 219, 224, 229, 234, 239, 244, 250, 255]
+TADD_7135 = 5.0
+TADD_FET = 300.0
+# crescendo's tk-sense.h settings
+SENSE_SIZE = 8
+SENSE_IIR = 3
+SENSE_DECIMATE = 8
+LAG = 8            # emitter -> driver thermal lag, in steps
+ADJUST = 4         # driver temperature is 13.2 fixed-point
+TIMESTEP = 0.5     # thermal regulation runs every 0.5 seconds
+
+# default sweep
+SWEEP = {
+    'prediction_strength': [0, 1, 2, 3, 4, 5, 6],
+    'lowpass': [2, 4, 6, 8, 12, 16],
+    'diff_attenuation': [0, 1, 2, 3, 4, 5, 6, 7, 8],
+    'thermal_mass': [16, 32, 64],
+}
+
+# firmware names for each tunable (thermal_mass is the host, not the firmware)
+DEFINES = [
+    ('prediction_strength', 'THERM_PREDICTION_STRENGTH'),
+    ('diff_attenuation', 'THERM_DIFF_ATTENUATION'),
+    ('lowpass', 'THERM_LOWPASS'),
+]
+
+# score columns, and whether bigger is better
+SCORES = [
+    ('overshoot', False),      # peak emitter temp above the ceiling, C
+    ('time_above', False),     # seconds with the emitter above the ceiling
+    ('lumen_minutes', True),   # light delivered, relative to full power
+    ('oscillations', False),   # how often the level changes direction
+]
+
+# a ramp file has the two tables as firmware or python lines, like
+#   #define RAMP_7135 3,3,4,...
+#   RAMP_FET = [0, 2, 3, ...]
+RAMP_LINE = re.compile(r'^\s*(?:#define\s+)?RAMP_(7135|FET)\s*=?\s*\[?([0-9,\s]+)\]?\s*$')
+
+
+def main(args):
+    """Sweep thermal regulation parameters (vectorized sim.py)
+    Runs the same thermal model as sim.py for every combination of
+    parameters at once, scores each run, and prints the Pareto front plus
+    firmware #defines for the best-balanced point on it.
+    Ramp tables are a sweep axis too: each --ramp file holds a RAMP_7135
+    and a RAMP_FET table (see RAMP_LINE), and "default" is the built-in
+    pair sim.py uses.
+    The regulation side follows crescendo.c (tk-sense.h's median, lowpass,
+    and least-squares slope, projected = filtered + (slope >> strength),
+    the lowpass counters, floor at RAMP_SIZE/4), so the results apply
+    directly.
+    """
+    parser = argparse.ArgumentParser(description=main.__doc__.split('\n')[0])
+    parser.add_argument('--mah', type=float, default=700.0,
+                        help='battery capacity (sets run length)')
+    parser.add_argument('--maxtemp', type=int, default=50,
+                        help='temperature ceiling, C')
+    parser.add_argument('--window', type=int, default=10,
+                        help='THERM_WINDOW_SIZE, C')
+    parser.add_argument('--procs', type=int, default=multiprocessing.cpu_count(),
+                        help='worker processes')
+    parser.add_argument('--seed', type=int, default=0,
+                        help='sensor noise seed (same noise for every run)')
+    parser.add_argument('--pick', type=int, default=None,
+                        help='use this row of the Pareto front for #defines')
+    parser.add_argument('--csv', default=None,
+                        help='write every run and its scores to this file')
+    parser.add_argument('--ramp', nargs='+', default=['default'],
+                        help='ramp table files to sweep ("default" is built in)')
+    for name, values in SWEEP.items():
+        parser.add_argument('--' + name.replace('_', '-'), type=int, nargs='+',
+                            default=values)
+    opts = parser.parse_args(args)
+
+    ramps = []
+    for filename in opts.ramp:
+        try:
+            ramps.append(load_ramp(filename))
+        except (IOError, ValueError) as e:
+            print('ERROR: %s' % e)
+            return 1
+
+    # ramp first, so each chunk mostly simulates one ramp
+    axes = ['ramp'] + list(SWEEP)
+    values = [range(len(ramps))] + [getattr(opts, n) for n in SWEEP]
+    grid = np.array(np.meshgrid(*values, indexing='ij')).reshape(len(axes), -1)
+    params = dict(zip(axes, grid))
+    runs = grid.shape[1]
+    procs = max(1, min(opts.procs, runs))
+
+    # split into one chunk per worker
+    edges = np.linspace(0, runs, procs + 1).astype(int)
+    chunks = [({n: v[a:b] for n, v in params.items()}, ramps, opts)
+              for a, b in zip(edges[:-1], edges[1:]) if b > a]
+    if procs > 1:
+        pool = multiprocessing.Pool(procs)
+        results = pool.map(run_chunk, chunks)
+        pool.close()
+    else:
+        results = [run_chunk(c) for c in chunks]
+    scores = {n: np.concatenate([r[n] for r in results]) for n, _ in SCORES}
+
+    print('%i runs, %i steps each, %i processes' %
+          (runs, steps(opts.mah), procs))
+
+    if opts.csv:
+        with open(opts.csv, 'w') as fp:
+            fp.write(','.join(axes + [n for n, _ in SCORES]) + '\n')
+            for i in range(runs):
+                fp.write(','.join([ramps[params['ramp'][i]][0]] +
+                                  ['%i' % params[n][i] for n in SWEEP] +
+                                  ['%g' % scores[n][i] for n, _ in SCORES]) +
+                         '\n')
+
+    front = pareto_front(scores)
+    # best balance: closest to the ideal point, after normalizing
+    order = front[np.argsort(distance(scores)[front])]
+
+    print('')
+    print('Pareto front (%i of %i runs), best balance first:' %
+          (len(order), runs))
+    header = ' '.join('%8s' % n[:8] for n in axes)
+    header += ' | ' + ' '.join('%13s' % n for n, _ in SCORES)
+    print('  #  ' + header)
+    for row, i in enumerate(order):
+        line = '%8s ' % ramps[params['ramp'][i]][0][:8]
+        line += ' '.join('%8i' % params[n][i] for n in SWEEP)
+        line += ' | ' + ' '.join('%13.1f' % scores[n][i] for n, _ in SCORES)
+        print('%3i  %s' % (row, line))
+
+    pick = opts.pick if opts.pick is not None else 0
+    if not (0 <= pick < len(order)):
+        print('ERROR: --pick must be 0 to %i' % (len(order) - 1))
+        return 1
+    i = order[pick]
+    print('')
+    print('// sim_sweep.py: row %i, ramp %s, thermal_mass %i, ceiling %i C' %
+          (pick, ramps[params['ramp'][i]][0], params['thermal_mass'][i],
+           opts.maxtemp))
+    for name, define in DEFINES:
+        print('#define %s %i' % (define, params[name][i]))
+
+    return 0
+
+
+def steps(mah):
+    max_seconds = int(mah * 60.0 / 100.0 * 1.5)
+    return int(max_seconds / TIMESTEP) + 1
+
+
+def load_ramp(filename):
+    """(name, RAMP_7135, RAMP_FET) from a ramp file, or the built-in pair"""
+    if filename == 'default':
+        return ('default', RAMP_7135, RAMP_FET)
+    tables = {}
+    with open(filename) as fp:
+        for line in fp:
+            match = RAMP_LINE.match(line)
+            if match:
+                tables[match.group(1)] = [int(x) for x in
+                                          match.group(2).replace(',', ' ').split()]
+    for name in ('7135', 'FET'):
+        if not tables.get(name):
+            raise ValueError('%s has no RAMP_%s table' % (filename, name))
+        if not all(0 <= x <= 255 for x in tables[name]):
+            raise ValueError('%s: RAMP_%s values must be 0 to 255' %
+                             (filename, name))
+    name = os.path.splitext(os.path.basename(filename))[0]
+    return (name, tables['7135'], tables['FET'])
+
+
+def run_chunk(chunk):
+    """Simulate a batch of runs, one call per ramp in the batch"""
+    params, ramps, opts = chunk
+    which = params['ramp']
+    scores = {n: np.zeros(len(which)) for n, _ in SCORES}
+    for r in np.unique(which):
+        mask = which == r
+        part = simulate({n: v[mask] for n, v in params.items()},
+                        ramps[r], opts)
+        for n, _ in SCORES:
+            scores[n][mask] = part[n]
+    return scores
+
+
+def simulate(params, ramp_tables, opts):
+    """Simulate one ramp's runs, one array element per parameter set"""
+    _, ramp_7135, ramp_fet = ramp_tables
+    ps = params['prediction_strength'].astype(np.int64)
+    lowpass = params['lowpass'].astype(np.int64)
+    att = params['diff_attenuation'].astype(np.int64)
+    mass = params['thermal_mass'].astype(np.float64)
+    n = len(ps)
+
+    ramp = np.array([x / 57.0 for x in ramp_7135] + list(ramp_fet))
+    temp_ramp = np.array(
+        [ROOM_TEMP + (x / 255.0 * TADD_7135) for x in ramp_7135] +
+        [ROOM_TEMP + TADD_7135 + (x / 255.0 * TADD_FET) for x in ramp_fet])
+    temp_ramp = np.power(temp_ramp, 1.0 / 1.01)
+    lvl = len(ramp)
+    lowest_stepdown = len(ramp) // 4
+
+    num_steps = steps(opts.mah)
+    max_seconds = (num_steps - 1) * TIMESTEP
+    ceil = opts.maxtemp * ADJUST
+    floor = (opts.maxtemp - opts.window) * ADJUST
+
+    # same sensor noise for every run, so they're compared fairly
+    rng = np.random.RandomState(opts.seed)
+    noise = rng.randint(-2, 3, size=num_steps)
+
+    thermal_lag = np.full((n, LAG), float(ROOM_TEMP))
+    drv_values = np.full((n, 4), ROOM_TEMP, dtype=np.int64)
+    # tk-sense.h state, as after sense_reset() on the first reading
+    sense_prev = np.full((n, 2), ROOM_TEMP * ADJUST, dtype=np.int64)
+    sense_lp = np.full(n, (ROOM_TEMP * ADJUST) << 4, dtype=np.int64)
+    sense_ring = np.full((n, SENSE_SIZE), ROOM_TEMP * ADJUST, dtype=np.int64)
+    sense_idx = 0
+    sense_tick = 0
+    actual = np.full(n, lvl, dtype=np.int64)
+    overheat = np.zeros(n, dtype=np.int64)
+    underheat = np.zeros(n, dtype=np.int64)
+    last_dir = np.zeros(n, dtype=np.int64)
+
+    peak = np.full(n, float(ROOM_TEMP))
+    time_above = np.zeros(n)
+    lumen_minutes = np.zeros(n)
+    oscillations = np.zeros(n, dtype=np.int64)
+
+    for step in range(num_steps):
+        seconds = step * TIMESTEP
+        sag = ((max_seconds - seconds) / max_seconds) ** (1.0 / 9)
+
+        # apply heat step
+        target = temp_ramp[actual - 1]
+        current = ROOM_TEMP + sag * (thermal_lag[:, -1] - ROOM_TEMP)
+        current = np.maximum(ROOM_TEMP, current + (target - current) / mass)
+        thermal_lag[:, :-1] = thermal_lag[:, 1:]
+        thermal_lag[:, -1] = current
+
+        # driver's view of the temperature
+        this = thermal_lag[:, :LAG // 2].mean(axis=1)
+        val = (ROOM_TEMP + (this - ROOM_TEMP) * 0.8).astype(np.int64)
+        drv_values[:, :-1] = drv_values[:, 1:]
+        drv_values[:, -1] = val + noise[step]
+        drv = np.maximum(ROOM_TEMP * ADJUST, drv_values.sum(axis=1))
+
+        # thermal regulation algorithm: sense_add(), then sense_slope()
+        lo = sense_prev.min(axis=1)
+        hi = sense_prev.max(axis=1)
+        med = np.clip(drv, lo, hi)
+        sense_prev[:, 0] = sense_prev[:, 1]
+        sense_prev[:, 1] = drv
+        sense_lp += np.right_shift(np.left_shift(med, 4) - sense_lp, SENSE_IIR)
+        filtered = np.right_shift(sense_lp + 8, 4)
+        sense_tick += 1
+        if not (sense_tick % SENSE_DECIMATE):
+            sense_ring[:, sense_idx] = filtered
+            sense_idx = (sense_idx + 1) % SENSE_SIZE
+        newest = sense_ring[:, (sense_idx - 1) % SENSE_SIZE]
+        oldest_first = np.roll(sense_ring, -sense_idx, axis=1) - newest[:, None]
+        running = np.cumsum(oldest_first, axis=1)
+        slope = running[:, -1] * (SENSE_SIZE + 1) - 2 * running.sum(axis=1)
+        projected = filtered + np.right_shift(slope, ps)
+
+        before = actual.copy()
+        hot = projected > ceil
+        cold = (~hot) & (projected < floor)
+
+        step_hot = hot & (overheat > lowpass)
+        exceed = np.maximum(1, np.right_shift(projected - ceil, att))
+        stepdown = actual - exceed
+        actual = np.where(step_hot & (stepdown >= lowest_stepdown),
+                          stepdown, actual)
+        overheat = np.where(hot, np.where(step_hot, 0, overheat + 1), 0)
+
+        step_cold = cold & (underheat > (lowpass // 2))
+        actual = np.where(step_cold & (actual < lvl), actual + 1, actual)
+        underheat = np.where(hot, 0,
+                             np.where(cold,
+                                      np.where(step_cold, 0, underheat + 1),
+                                      underheat))
+
+        # scoring
+        direction = np.sign(actual - before)
+        oscillations += (direction != 0) & (last_dir != 0) & \
+                        (direction != last_dir)
+        last_dir = np.where(direction != 0, direction, last_dir)
+        peak = np.maximum(peak, current)
+        time_above += (current > opts.maxtemp) * TIMESTEP
+        lumen_minutes += (sag ** 2) * ramp[actual - 1] / 255.0 * TIMESTEP / 60.0
+
+    return {
+        'overshoot': np.maximum(0.0, peak - opts.maxtemp),
+        'time_above': time_above,
+        'lumen_minutes': lumen_minutes,
+        'oscillations': oscillations.astype(np.float64),
+    }
+
+
+def costs(scores):
+    """All scores as columns where smaller is better"""
+    return np.column_stack([-scores[n] if bigger else scores[n]
+                            for n, bigger in SCORES])
+
+
+def pareto_front(scores):
+    """Indexes of runs which no other run beats on every score"""
+    c = costs(scores)
+    keep = np.ones(len(c), dtype=bool)
+    # compare in blocks so thousands of runs don't need a huge matrix
+    block = max(1, 4000000 // max(1, len(c)))
+    for start in range(0, len(c), block):
+        part = c[start:start + block]
+        no_worse = (c[None, :, :] <= part[:, None, :]).all(axis=2)
+        better = (c[None, :, :] < part[:, None, :]).any(axis=2)
+        keep[start:start + block] = ~(no_worse & better).any(axis=1)
+    return np.nonzero(keep)[0]
+
+
+def distance(scores):
+    """Distance from the ideal point, with each score scaled 0 to 1"""
+    c = costs(scores)
+    span = c.max(axis=0) - c.min(axis=0)
+    span[span == 0] = 1.0
+    return np.sqrt((((c - c.min(axis=0)) / span) ** 2).sum(axis=1))
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,150 @@
+#!/usr/bin/env python
+
+import os
+import sys
+import shutil
+import argparse
+import tempfile
+import subprocess
+
+import bench
+
+
+# Data-space addresses of the registers which matter for sleep current
+REGS = {
+    'attiny13': {'ADCSRA': 0x26, 'ACSR': 0x28, 'DIDR0': 0x34, 'DDRB': 0x37,
+                 'PORTB': 0x38, 'WDTCR': 0x41, 'BODCR': 0x50, 'MCUCR': 0x55},
+    'attiny25': {'ADCSRA': 0x26, 'ACSR': 0x28, 'DIDR0': 0x34, 'DDRB': 0x37,
+                 'PORTB': 0x38, 'WDTCR': 0x41, 'MCUCR': 0x55},
+}
+
+# Rough typical currents at about 4V, in uA, from the datasheets.
+# Good enough to tell 0.2 uA from 20 uA, which is the point.
+CORE = {'attiny13': 0.2, 'attiny25': 0.2}  # power-down, WDT and BOD off
+WDT = 5.0
+BOD = 20.0
+ADC = 80.0          # left enabled: the ADC and its reference keep running
+COMPARATOR = 30.0
+PULLUP = 110.0      # into a pin which is grounded on the board
+FLOATING = 50.0     # digital input buffer on a floating / mid-rail pin
+
+# Long enough for LVP to step all the way down and shut off
+SCENARIO = """
+    0 adc 1 450
+    0 adc 2 450
+    0 adc 3 450
+    0 adc temp 25000
+    300000 end
+"""
+
+
+def main(args):
+    """Current budget after a firmware shuts itself off, under simavr
+    Runs the firmware with the cell below the low-voltage cutoff until it
+    shuts down (sleeps with interrupts off), then reads what's still
+    powered from the register state and adds up the current that leaves
+    behind.  Fails if the MCU's share is over --max.
+    """
+    parser = argparse.ArgumentParser(description=main.__doc__.split('\n')[0])
+    parser.add_argument('firmware', nargs='+',
+                        help='firmware name, like "crescendo"')
+    parser.add_argument('--mcu', default='attiny13', choices=sorted(REGS))
+    parser.add_argument('--scenario', default=None,
+                        help='scenario file (default: a dead cell from power-on)')
+    parser.add_argument('--bod', action='store_true',
+                        help='the fuses enable the brown-out detector')
+    parser.add_argument('--divider', default='22000,4700',
+                        help='voltage divider R1,R2 in ohms ("0" for none)')
+    parser.add_argument('--volts', type=float, default=3.0,
+                        help='cell voltage, for the divider current')
+    parser.add_argument('--max', type=float, default=1.0,
+                        help='most uA the MCU itself should draw')
+    opts = parser.parse_args(args)
+
+    for tool in ('avr-gcc', 'avr-nm', 'cc'):
+        if not shutil.which(tool):
+            print('ERROR: %s not found' % tool)
+            return 1
+
+    divider = [float(r) for r in opts.divider.split(',') if float(r)]
+    failed = 0
+    work = tempfile.mkdtemp(prefix='sleep-')
+    try:
+        harness = bench.build_harness(work)
+        if not harness:
+            return 1
+        text = open(opts.scenario).read() if opts.scenario else SCENARIO
+        scenario = os.path.join(work, 'scenario.txt')
+        with open(scenario, 'w') as fp:
+            fp.write('\n'.join(l.strip() for l in text.splitlines()) + '\n')
+
+        for fw in opts.firmware:
+            elf = bench.build(fw, opts.mcu, work, [])
+            if not elf:
+                return 1
+            halt, io = run(harness, elf, opts.mcu, scenario)
+            if halt is None:
+                print('ERROR: %s never shut down' % fw)
+                failed += 1
+                continue
+            regs = dict((k, io.get(a, 0)) for k, a in REGS[opts.mcu].items())
+            items = budget(regs, opts)
+            mcu = sum(ua for _, ua in items)
+            print('%s on %s, shut down at %.1fs:' % (fw, opts.mcu, halt / 1000.0))
+            for what, ua in items:
+                print('  %-40s %7.1f uA' % (what, ua))
+            if divider:
+                ua = opts.volts / sum(divider) * 1e6
+                print('  %-40s %7.1f uA' % ('voltage divider (not the MCU)', ua))
+            print('  %-40s %7.1f uA' % ('MCU total', mcu))
+            if mcu > opts.max:
+                print('ERROR: %s draws %.1f uA after shutdown (max %g)' %
+                      (fw, mcu, opts.max))
+                failed += 1
+    finally:
+        shutil.rmtree(work)
+
+    return 1 if failed else 0
+
+
+def run(harness, elf, mcu, scenario):
+    """When the firmware halted (ms), and its I/O registers at that point"""
+    f_cpu, _ = bench.MCUS[mcu]
+    out = subprocess.check_output([harness, elf, mcu, str(f_cpu), scenario]).decode()
+    halt, io = None, {}
+    for line in out.splitlines():
+        parts = line.split()
+        if parts[:1] == ['halt']:
+            halt = int(parts[1])
+        elif parts[:1] == ['io']:
+            io[int(parts[1], 0)] = int(parts[2], 0)
+    return halt, io
+
+
+def budget(regs, opts):
+    """What's still drawing current, and about how much"""
+    items = [('power-down core', CORE[opts.mcu])]
+    if regs['WDTCR'] & 0x48:  # WDIE / WDE
+        items.append(('watchdog still running', WDT))
+    # BODS is in MCUCR on attiny25, BODCR on attiny13A
+    bods = (regs['MCUCR'] & 0x80) or (regs.get('BODCR', 0) & 0x02)
+    if opts.bod and not bods:
+        items.append(('brown-out detector', BOD))
+    if regs['ADCSRA'] & 0x80:
+        items.append(('ADC still enabled', ADC))
+    if not (regs['ACSR'] & 0x80):
+        items.append(('analog comparator still on', COMPARATOR))
+    for pin in range(6):
+        bit = 1 << pin
+        if regs['DDRB'] & bit:
+            if regs['PORTB'] & bit:
+                items.append(('PB%i driven high (feeds its load)' % pin, PULLUP))
+        elif regs['PORTB'] & bit and not (regs['MCUCR'] & 0x40):  # PUD
+            items.append(('PB%i pull-up, if grounded' % pin, PULLUP))
+        elif not (regs['DIDR0'] & bit):
+            items.append(('PB%i input buffer, if floating' % pin, FLOATING))
+    return items
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,272 @@
+#!/usr/bin/env python
+
+import os
+import re
+import sys
+import argparse
+import subprocess
+
+
+# SRAM size per MCU
+RAM = {
+    'attiny13': 64,
+    'attiny25': 128,
+    'attiny45': 256,
+    'attiny85': 512,
+}
+
+RETURN_ADDR = 2  # bytes pushed by a call or an interrupt on these chips
+
+# PROGMEM tables of function pointers which indirect calls go through:
+# symbol -> (bytes per entry, offset of the pointer in each entry)
+CALL_TABLES = {
+    'mode_registry': (3, 0),  # crescendo's modes, called from run_mode()
+}
+
+
+def main(args):
+    """Worst-case stack depth and RAM headroom for a firmware .elf
+    Builds a call graph from the disassembly, adds up the stack frames
+    along the deepest path from main(), adds the deepest interrupt handler
+    on top, and compares the total plus .data/.bss/.noinit with the
+    MCU's RAM.  Frame sizes come from the prologues (pushes and frame
+    allocation), cross-checked with the -fstack-usage .su file if there
+    is one next to the .elf.
+    Indirect calls count as calls to every function in the known call
+    tables (like crescendo's mode_registry) which the .elf has, so the
+    worst case covers all of them; any other indirect call is an error,
+    since its stack use can't be counted.
+    """
+    parser = argparse.ArgumentParser(description=main.__doc__.split('\n')[0])
+    parser.add_argument('elf', help='firmware .elf file')
+    parser.add_argument('--mcu', default='attiny13', choices=sorted(RAM))
+    parser.add_argument('--margin', type=int, default=0,
+                        help='fail if fewer bytes than this are left over')
+    parser.add_argument('--table', action='append', default=[],
+                        metavar='SYMBOL:SIZE[:OFFSET]',
+                        help='another table of function pointers, with its entry size')
+    parser.add_argument('-v', '--verbose', action='store_true',
+                        help='list every function')
+    opts = parser.parse_args(args)
+
+    try:
+        disasm = subprocess.check_output(['avr-objdump', '-d', opts.elf]).decode()
+        sizes = subprocess.check_output(['avr-size', '-A', opts.elf]).decode()
+        symbols = subprocess.check_output(['avr-nm', '-S', opts.elf]).decode()
+        flash = subprocess.check_output(['avr-objdump', '-s', '-j', '.text',
+                                         opts.elf]).decode()
+    except (OSError, subprocess.CalledProcessError) as e:
+        print('ERROR: %s' % e)
+        return 1
+
+    tables = dict(CALL_TABLES)
+    for t in opts.table:
+        parts = t.split(':')
+        try:
+            tables[parts[0]] = (int(parts[1]), int(parts[2]) if len(parts) > 2 else 0)
+        except (IndexError, ValueError):
+            print('ERROR: --table %s: expected SYMBOL:SIZE[:OFFSET]' % t)
+            return 1
+
+    funcs = parse_disasm(disasm)
+    targets = table_targets(tables, parse_nm(symbols), parse_dump(flash))
+    for func in funcs.values():
+        if func['icalls'] and targets:
+            func['calls'] |= targets
+            func['resolved'] = True
+    su = os.path.splitext(opts.elf)[0] + '.su'
+    if os.path.exists(su):
+        for name, size in parse_su(su).items():
+            if name in funcs:
+                funcs[name]['frame'] = max(funcs[name]['frame'], size)
+
+    if 'main' not in funcs:
+        print('ERROR: no main() in %s' % opts.elf)
+        return 1
+
+    depths = {}
+    isr_depth, isr_path = 0, []
+    try:
+        main_depth, main_path = depth('main', funcs, depths, [])
+        for name in sorted(funcs):
+            if re.match(r'__vector_\d+$', name):
+                d, path = depth(name, funcs, depths, [])
+                if d > isr_depth:
+                    isr_depth, isr_path = d, path
+    except RecursionError as e:
+        print('ERROR: recursion: %s' % e)
+        return 1
+
+    statics = {}
+    for line in sizes.splitlines():
+        parts = line.split()
+        if len(parts) >= 2 and parts[0] in ('.data', '.bss', '.noinit'):
+            statics[parts[0]] = int(parts[1])
+    static = sum(statics.values())
+
+    # crt calls main(), interrupts land on top of the deepest main() frame
+    stack = RETURN_ADDR + main_depth
+    if isr_path:
+        stack += RETURN_ADDR + isr_depth
+    ram = RAM[opts.mcu]
+    left = ram - static - stack
+
+    if opts.verbose:
+        print('%-28s %5s %5s' % ('function', 'frame', 'depth'))
+        for name in sorted(depths, key=lambda n: -depths[n][0]):
+            print('%-28s %5i %5i' % (name, funcs[name]['frame'], depths[name][0]))
+        print('')
+
+    unknown = sorted(unknown_calls(funcs, depths))
+    for name, calls in unknown:
+        print('ERROR: %s makes %i indirect call(s) which no call table covers' %
+              (name, calls))
+    if targets and opts.verbose:
+        print('indirect calls can reach: %s' % ', '.join(sorted(targets)))
+    print('static RAM: %i bytes (%s)' % (static, ', '.join(
+        '%s %i' % (k, v) for k, v in sorted(statics.items()))))
+    print('main stack: %i bytes via %s' % (RETURN_ADDR + main_depth,
+                                           ' > '.join(main_path)))
+    if isr_path:
+        print('ISR stack:  %i bytes via %s' % (RETURN_ADDR + isr_depth,
+                                               ' > '.join(isr_path)))
+    print('worst case: %i of %i bytes used, %i left' % (static + stack, ram, left))
+
+    if left < opts.margin:
+        print('ERROR: stack can reach .noinit (%i bytes short)' %
+              (opts.margin - left))
+        return 1
+    if unknown:
+        print('(add the table with --table, so its functions are counted)')
+        return 1
+    return 0
+
+
+def parse_disasm(text):
+    """Functions, with frame size and who they call"""
+    funcs = {}
+    func = None
+    for line in text.splitlines():
+        m = re.match(r'^([0-9a-f]+) <([^>]+)>:$', line)
+        if m:
+            func = {'frame': 0, 'calls': set(), 'tails': set(),
+                    'icalls': 0, 'resolved': False, 'count': 0, 'sp_read': False}
+            funcs[m.group(2)] = func
+            continue
+        if func is None:
+            continue
+        m = re.match(r'^\s+[0-9a-f]+:\s+(?:[0-9a-f]{2} )+\s*(\S+)\s*([^;]*)(?:;.*<([^>+]+)(\+0x[0-9a-f]+)?>)?', line)
+        if not m:
+            continue
+        op, operands, target, offset = m.groups()
+        operands = operands.strip()
+        func['count'] += 1
+        prologue = func['count'] <= 24
+        if op == 'push':
+            func['frame'] += 1
+        elif prologue and op == 'rcall' and operands == '.+0':
+            func['frame'] += 2  # gcc's short way to reserve 2 bytes
+        elif prologue and op == 'in' and operands.startswith('r28, 0x3d'):
+            func['sp_read'] = True
+        elif prologue and func['sp_read'] and op in ('sbiw', 'subi') \
+                and operands.startswith('r28'):
+            func['frame'] += int(operands.split(',')[1], 0)
+        elif op in ('rcall', 'call') and target:
+            func['calls'].add(target)
+        elif op in ('rjmp', 'jmp') and target and not offset:
+            func['tails'].add(target)  # tail call: our frame is gone already
+        elif op in ('icall', 'eicall'):
+            func['icalls'] += 1
+    # jumps to ourselves are loops, not tail calls
+    for name, func in funcs.items():
+        func['tails'].discard(name)
+    return funcs
+
+
+def parse_nm(text):
+    """Symbol name -> (address, size, type), from avr-nm -S"""
+    symbols = {}
+    for line in text.splitlines():
+        parts = line.split()
+        if len(parts) == 4:
+            symbols[parts[3]] = (int(parts[0], 16), int(parts[1], 16), parts[2])
+        elif len(parts) == 3:
+            symbols[parts[2]] = (int(parts[0], 16), 0, parts[1])
+    return symbols
+
+
+def parse_dump(text):
+    """Flash contents (address -> byte), from avr-objdump -s"""
+    flash = {}
+    for line in text.splitlines():
+        m = re.match(r'^ ([0-9a-f]{4,}) ((?:[0-9a-f]{2,8} ){1,4})', line)
+        if not m:
+            continue
+        addr = int(m.group(1), 16)
+        data = bytes.fromhex(''.join(m.group(2).split()))
+        for i, b in enumerate(bytearray(data)):
+            flash[addr + i] = b
+    return flash
+
+
+def table_targets(tables, symbols, flash):
+    """Every function named in the call tables which this .elf has"""
+    by_addr = {}
+    for name, (addr, size, kind) in symbols.items():
+        if kind in 'Tt':
+            by_addr[addr] = name
+    targets = set()
+    for table, (entry, offset) in tables.items():
+        if table not in symbols:
+            continue
+        addr, size, kind = symbols[table]
+        for i in range(addr + offset, addr + size, entry):
+            # function pointers are word addresses
+            word = flash.get(i, 0) | (flash.get(i + 1, 0) << 8)
+            if word and (word * 2) in by_addr:
+                targets.add(by_addr[word * 2])
+    return targets
+
+
+def parse_su(path):
+    """Frame sizes from gcc -fstack-usage"""
+    sizes = {}
+    for line in open(path):
+        parts = line.split('\t')
+        if len(parts) >= 2:
+            name = parts[0].split(':')[-1]
+            sizes[name] = int(parts[1])
+    return sizes
+
+
+def depth(name, funcs, depths, stack):
+    """Deepest stack use under this function, and the path to it"""
+    if name in depths:
+        return depths[name]
+    if name in stack:
+        raise RecursionError(' > '.join(stack + [name]))
+    func = funcs.get(name)
+    if func is None:  # not in the disassembly, so probably inline asm
+        return 0, [name]
+    best, path = func['frame'], [name]
+    for callee in func['calls']:
+        d, p = depth(callee, funcs, depths, stack + [name])
+        if func['frame'] + RETURN_ADDR + d > best:
+            best, path = func['frame'] + RETURN_ADDR + d, [name] + p
+    for callee in func['tails']:
+        if callee not in funcs:
+            continue
+        d, p = depth(callee, funcs, depths, stack + [name])
+        if d > best:
+            best, path = d, [name] + p
+    depths[name] = (best, path)
+    return best, path
+
+
+def unknown_calls(funcs, depths):
+    return [(n, funcs[n]['icalls']) for n in depths
+            if n in funcs and funcs[n]['icalls'] and not funcs[n]['resolved']]
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,210 @@
+/*
+ * Runs tk-strobe.h's interrupt handler on the host, with a model of
+ * Timer0 in CTC mode, and checks each party strobe mode against what it's
+ * supposed to do.  Scripts/strobe_check.py builds and runs this once per
+ * MCU (F_CPU comes from the command line).
+ *
+ * The modes call strobe_set() / strobe_start() / strobe_wait() the same
+ * way crescendo.c does, and the timer runs whatever tk-strobe.h put in
+ * TCCR0B and OCR0A.  The light's edges are timed from that, and compared
+ * with a table written in real units (Hz, us, ms), not timer ticks, so a
+ * mistake in the tick macros shows up instead of being repeated here.
+ * Prints one line per mode ("name flashes freq_error% flash_error%"), and
+ * ERROR lines for anything out of tolerance, or for a timer segment too
+ * short for the interrupt to catch.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#ifndef F_CPU
+#define F_CPU 4800000uL
+#endif
+
+// how far from nominal is okay, from the firmware's own math (the RC
+// oscillator adds a few percent of its own on top, which this can't see)
+#define MAX_FREQ_ERROR 0.1   // percent, only rounding to whole ticks
+#define MAX_FLASH_ERROR 5.0  // percent (a 200us flash is only 15 ticks)
+// the interrupt needs a tick to reload OCR0A before the count passes it
+#define MIN_SEGMENT 2
+
+// stand-ins for the hardware (Scripts/strobe_check.py supplies empty
+// avr/interrupt.h and avr/sleep.h)
+#define TK_ATTINY_H
+#define PWM_PIN 1
+#define PHASE 0xA1
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM01 1
+#define OCIE0A 2
+#define ISR(vect) void vect(void)
+#define cli()
+#define sei()
+#define set_sleep_mode(mode)
+#define SLEEP_MODE_IDLE 0
+void sleep_mode(void);
+uint8_t PORTB, TCCR0A, TCCR0B, TCNT0, OCR0A, TIMSK0;
+
+#include "../tk-strobe.h"
+
+double now;          // CPU cycles since the start
+double edges[1024];  // when the light went on, off, on, ...
+int edge_count;
+int short_segments;
+
+void sleep_mode(void) {
+    // run Timer0 to the next compare match (it counts 0 to OCR0A, then
+    // clears), then the interrupt
+    static const uint16_t prescale[] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    uint8_t lit = PORTB & (1 << PWM_PIN);
+    if (! (TIMSK0 & (1 << OCIE0A)) || ! prescale[TCCR0B & 7]) {
+        printf("ERROR: sleeping with the strobe timer stopped\n");
+        exit(1);
+    }
+    if (OCR0A + 1 < MIN_SEGMENT) short_segments ++;
+    now += (double)(OCR0A + 1) * prescale[TCCR0B & 7];
+    TCNT0 = 0;
+    TIM0_COMPA_vect();
+    if (((PORTB & (1 << PWM_PIN)) != lit) && (edge_count < 1024))
+        edges[edge_count++] = now;
+}
+
+// crescendo.c's party strobes, as they call tk-strobe.h
+#define PARTY_ONTIME STROBE_US(200)
+
+void party_strobe(uint16_t ontime, uint16_t offtime) {
+    strobe_set(ontime, offtime);
+    strobe_start();
+    strobe_wait(1);
+}
+
+void party_strobe_loop(uint16_t ontime, uint16_t period) {
+    strobe_set(ontime, period - ontime);
+    strobe_start();
+    strobe_wait(32);
+}
+
+void party_strobe12_mode() { party_strobe_loop(STROBE_MS(1), STROBE_HZ(12)); }
+void party_strobe24_mode() { party_strobe_loop(PARTY_ONTIME, STROBE_HZ(24)); }
+void party_strobe60_mode() { party_strobe_loop(PARTY_ONTIME, STROBE_HZ(60)); }
+
+void party_varstrobe1_mode() {
+    uint8_t j, speed;
+    for(j=0; j<66; j++) {
+        speed = (j<33) ? j : 66-j;
+        party_strobe(STROBE_MS(1),
+                     (uint16_t)((speed+33-6)<<1) * STROBE_TICKS_PER_MS);
+    }
+}
+
+void party_varstrobe2_mode() {
+    uint8_t j, speed;
+    for(j=0; j<100; j++) {
+        speed = (j<50) ? j : 100-j;
+        party_strobe(PARTY_ONTIME,
+                     (uint16_t)(speed+9) * STROBE_TICKS_PER_MS);
+    }
+}
+
+// What each mode should do (from crescendo.txt and the mode comments):
+// a flash this long, then either a fixed frequency, or a dark time which
+// sweeps from lo to hi ms and back in steps of step ms
+struct expect {
+    const char *name;
+    void (*run)();
+    uint16_t flash_us;
+    uint8_t hz;
+    uint8_t lo_ms, hi_ms, step_ms;
+} modes[] = {
+    { "PARTY_STROBE12",   party_strobe12_mode,   1000, 12 },
+    { "PARTY_STROBE24",   party_strobe24_mode,    200, 24 },
+    { "PARTY_STROBE60",   party_strobe60_mode,    200, 60 },
+    { "PARTY_VARSTROBE1", party_varstrobe1_mode, 1000,  0,  54, 120, 2 },
+    { "PARTY_VARSTROBE2", party_varstrobe2_mode,  200,  0,   9,  59, 1 },
+};
+
+double expected_period(struct expect *m, int flash) {
+    // in us
+    int steps, i;
+    if (m->hz) return 1000000.0 / m->hz;
+    steps = (m->hi_ms - m->lo_ms) / m->step_ms;
+    i = flash % (steps * 2);
+    if (i > steps) i = steps * 2 - i;
+    return m->flash_us + (m->lo_ms + i * m->step_ms) * 1000.0;
+}
+
+int main() {
+    double cycle_us = 1000000.0 / F_CPU;
+    int errors = 0;
+    unsigned int n;
+
+    for (n = 0; n < sizeof(modes) / sizeof(modes[0]); n++) {
+        struct expect *m = modes + n;
+        double worst_f = 0, worst_on = 0;
+        int flash, flashes;
+
+        // start cold, like after a mode change, and run the mode twice
+        // (the way the main loop calls it) so every flash has a full
+        // dark time after it
+        TIMSK0 = 0;
+        PORTB = 0;
+        now = 0;
+        edge_count = 0;
+        short_segments = 0;
+        m->run();
+        flashes = edge_count / 2;
+        m->run();
+        strobe_stop();
+
+        for (flash = 0; flash < flashes; flash++) {
+            double on = (edges[flash*2 + 1] - edges[flash*2]) * cycle_us;
+            double period = (edges[flash*2 + 2] - edges[flash*2]) * cycle_us;
+            double want = expected_period(m, flash);
+            double f_err = 100.0 * (period - want) / want;
+            double on_err = 100.0 * (on - m->flash_us) / m->flash_us;
+            if (f_err < 0) f_err = -f_err;
+            if (on_err < 0) on_err = -on_err;
+            if (f_err > worst_f) worst_f = f_err;
+            if (on_err > worst_on) worst_on = on_err;
+        }
+
+        printf("%s %d %.3f %.2f\n", m->name, flashes, worst_f, worst_on);
+        if (! flashes) {
+            printf("ERROR: %s never flashed\n", m->name);
+            errors ++;
+        }
+        if (worst_f > MAX_FREQ_ERROR) {
+            printf("ERROR: %s is %.2f%% off its frequency\n", m->name, worst_f);
+            errors ++;
+        }
+        if (worst_on > MAX_FLASH_ERROR) {
+            printf("ERROR: %s flashes are %.1f%% off their length\n", m->name, worst_on);
+            errors ++;
+        }
+        if (short_segments) {
+            printf("ERROR: %s set %d timer segment(s) shorter than %d ticks\n",
+                   m->name, short_segments, MIN_SEGMENT);
+            errors ++;
+        }
+    }
+
+    return errors ? 1 : 0;
+}
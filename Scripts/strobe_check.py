@@ -0,0 +1,91 @@
+#!/usr/bin/env python
+
+import os
+import re
+import sys
+import shutil
+import argparse
+import tempfile
+import subprocess
+
+
+here = os.path.dirname(os.path.abspath(__file__))
+top = os.path.dirname(here)
+
+
+def main(args):
+    """Checks party strobe timing (crescendo.c + tk-strobe.h).
+    Builds Scripts/strobe_check.c with the host compiler, once per MCU in
+    tk-attiny.h, and runs it: tk-strobe.h's interrupt handler flashes the
+    light from a model of Timer0, and each mode's edges are checked
+    against its nominal frequency and flash length.
+    """
+    parser = argparse.ArgumentParser(description=main.__doc__.split('\n')[0])
+    parser.add_argument('attiny', nargs='*', type=int,
+                        help='MCU(s) to check, like 13 (default: all)')
+    opts = parser.parse_args(args)
+
+    if not shutil.which('cc'):
+        print('ERROR: cc not found')
+        return 1
+
+    clocks = f_cpus(os.path.join(top, 'tk-attiny.h'))
+    attinys = opts.attiny or sorted(clocks)
+    for attiny in attinys:
+        if attiny not in clocks:
+            print('ERROR: tk-attiny.h has no F_CPU for attiny%s' % attiny)
+            return 1
+
+    errors = 0
+    work = tempfile.mkdtemp(prefix='strobe-check-')
+    try:
+        # the harness supplies everything these would
+        os.mkdir(os.path.join(work, 'avr'))
+        for name in ('interrupt.h', 'sleep.h'):
+            open(os.path.join(work, 'avr', name), 'w').close()
+        for attiny in attinys:
+            out = os.path.join(work, 'strobe_check')
+            cmd = ['cc', '-O2', '-I', work, '-o', out,
+                   '-DF_CPU=%iuL' % clocks[attiny],
+                   os.path.join(here, 'strobe_check.c')]
+            if subprocess.call(cmd):
+                print('ERROR: could not build strobe_check.c')
+                return 1
+            proc = subprocess.Popen([out], stdout=subprocess.PIPE)
+            text = proc.communicate()[0].decode()
+            print('attiny%s: %i Hz' % (attiny, clocks[attiny]))
+            for line in text.splitlines():
+                if line.startswith('ERROR'):
+                    print('  ' + line)
+                    continue
+                name, flashes, f_err, on_err = line.split()
+                print('  %s: %s flashes, frequency error %s%%, '
+                      'flash length error %s%%' %
+                      (name, flashes, f_err, on_err))
+            if proc.returncode:
+                errors += 1
+    finally:
+        shutil.rmtree(work)
+
+    return 1 if errors else 0
+
+
+def f_cpus(path):
+    """ATTINY -> F_CPU, from the "#if (ATTINY == N)" blocks"""
+    clocks = {}
+    attiny = None
+    for line in open(path):
+        m = re.match(r'#\s*(?:el)?if\s*\(ATTINY\s*==\s*(\d+)\)', line)
+        if m:
+            attiny = int(m.group(1))
+            continue
+        m = re.match(r'#\s*define\s+F_CPU\s+\(?(\d+)', line)
+        if m and (attiny is not None):
+            clocks[attiny] = int(m.group(1))
+        elif re.match(r'#\s*(else|endif)', line):
+            attiny = None
+    return clocks
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -0,0 +1,77 @@
+/*
+ * Runs temperature readings through tk-sense.h on the host.
+ * Scripts/therm_bench.py builds this and parses the output.
+ *
+ * Usage: therm_bench < readings.txt
+ *   Input is one reading per line, in C as 13.2 fixed-point (like
+ *   current_temperature() returns), at one reading per main loop.
+ *   Output is one line per reading: "filtered projected legacy", where
+ *   projected is what crescendo steps down on now, and legacy is the old
+ *   "newest minus oldest, times 16" guess from the same readings.
+ *
+ * Build with -DSENSE_IIR=... (or SENSE_SIZE, SENSE_DECIMATE, or
+ * THERM_PREDICTION_STRENGTH) to try other settings.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+
+// crescendo's settings, unless given on the command line
+#ifndef SENSE_IIR
+#define SENSE_IIR 3
+#endif
+#ifndef SENSE_DECIMATE
+#define SENSE_DECIMATE 8
+#endif
+#ifndef THERM_PREDICTION_STRENGTH
+#define THERM_PREDICTION_STRENGTH 3
+#endif
+#include "../tk-sense.h"
+
+#define LEGACY_SIZE 8
+#define LEGACY_PREDICTION_STRENGTH 4
+
+int main() {
+    int16_t legacy[LEGACY_SIZE];
+    int first = 1;
+    int value;
+
+    while (scanf("%d", &value) == 1) {
+        int16_t temperature = value;
+        uint8_t t;
+
+        if (first) {
+            first = 0;
+            sense_reset(temperature);
+            for (t = 0; t < LEGACY_SIZE; t++) legacy[t] = temperature;
+        }
+
+        // the old way: shift the history, extrapolate from the ends
+        // (int16 here; the firmware's uint8 history wrapped above 63C)
+        for (t = 0; t < LEGACY_SIZE-1; t++) legacy[t] = legacy[t+1];
+        legacy[LEGACY_SIZE-1] = temperature;
+        int16_t old = temperature
+            + ((temperature - legacy[0]) << LEGACY_PREDICTION_STRENGTH);
+
+        int16_t filtered = sense_add(temperature);
+        int16_t projected = filtered + (sense_slope() >> THERM_PREDICTION_STRENGTH);
+
+        printf("%d %d %d\n", filtered, projected, old);
+    }
+    return 0;
+}
@@ -0,0 +1,218 @@
+#!/usr/bin/env python
+
+import os
+import sys
+import math
+import random
+import shutil
+import argparse
+import tempfile
+import subprocess
+
+
+here = os.path.dirname(os.path.abspath(__file__))
+
+# crescendo's step-down rule: this many readings in a row over the ceiling
+THERM_LOWPASS = 8
+
+# built-in traces: (description, true temperature at sample n, overheats?)
+# (one sample per main loop, about 2 per second)
+def idle(ceil, n):
+    return ceil - 10
+
+def approach(ceil, n):
+    # warms up and levels off just under the limit
+    return 25 + (ceil - 4 - 25) * (1 - math.exp(-n / 150.0))
+
+def overheat(ceil, n):
+    # warms up toward well over the limit
+    return 25 + (ceil + 15 - 25) * (1 - math.exp(-n / 300.0))
+
+SCENARIOS = [
+    ('idle', idle, False),
+    ('approach', approach, False),
+    ('overheat', overheat, True),
+]
+
+
+def main(args):
+    """Replays temperature traces through the thermal filter, on the host.
+    Builds Scripts/therm_bench.c (tk-sense.h plus the old predictor) with
+    the host compiler, feeds it readings, and applies crescendo's step-down
+    rule to both predictions.  Reports false step-downs (the real temperature
+    doesn't reach the ceiling within --horizon readings) and, for traces
+    which really overheat, how early each one reacted.
+    Built-in traces are simulated readings with gaussian noise and spikes.
+    A recorded trace has one reading per line in C, optionally followed by
+    the true temperature; without that, a centered moving average is used.
+    """
+    parser = argparse.ArgumentParser(description=main.__doc__.split('\n')[0])
+    parser.add_argument('trace', nargs='*',
+                        help='recorded trace file(s); default is the built-in ones')
+    parser.add_argument('--ceil', type=int, default=50,
+                        help='temperature ceiling in C')
+    parser.add_argument('--noise', type=float, default=1.0,
+                        help='reading noise, standard deviation in C')
+    parser.add_argument('--spikes', type=float, default=0.01,
+                        help='fraction of readings which are spikes')
+    parser.add_argument('--spike-size', type=float, default=12.0,
+                        help='spike height in C')
+    parser.add_argument('--length', type=int, default=2000,
+                        help='readings per simulated trace')
+    parser.add_argument('--runs', type=int, default=20,
+                        help='simulated traces per scenario')
+    parser.add_argument('--horizon', type=int, default=120,
+                        help='readings ahead a step-down may anticipate')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('-D', dest='defines', action='append', default=[],
+                        help='passed to the compiler, like SENSE_IIR=2')
+    opts = parser.parse_args(args)
+
+    if not shutil.which('cc'):
+        print('ERROR: cc not found')
+        return 1
+
+    work = tempfile.mkdtemp(prefix='therm-bench-')
+    try:
+        harness = build_harness(work, opts.defines)
+        if not harness:
+            return 1
+        random.seed(opts.seed)
+
+        if opts.trace:
+            runs = [(os.path.basename(t), load(t), None) for t in opts.trace]
+        else:
+            runs = []
+            for name, func, hot in SCENARIOS:
+                for r in range(opts.runs):
+                    truth = [func(opts.ceil, n) for n in range(opts.length)]
+                    readings = [noisy(t, opts) for t in truth]
+                    # the filter starts from the first reading, which the
+                    # firmware takes more carefully (it's an average anyway)
+                    readings[0] = truth[0]
+                    runs.append((name, (readings, truth), hot))
+
+        results = {}
+        for name, (readings, truth), hot in runs:
+            out = run(harness, readings)
+            row = results.setdefault(name, [0, 0, [], [], hot])
+            for i, col in enumerate((2, 1)):
+                steps = stepdowns([o[col] for o in out], opts.ceil)
+                row[i] += false_steps(steps, truth, opts.ceil, opts.horizon)
+                if hot:
+                    row[2 + i].append(lead(steps, truth, opts.ceil))
+    finally:
+        shutil.rmtree(work)
+
+    return report(results, opts)
+
+
+def build_harness(work, defines):
+    out = os.path.join(work, 'therm_bench')
+    cmd = ['cc', '-O2', '-o', out, os.path.join(here, 'therm_bench.c')]
+    cmd += ['-D' + d for d in defines]
+    if subprocess.call(cmd):
+        print('ERROR: could not build therm_bench.c')
+        return None
+    return out
+
+
+def noisy(t, opts):
+    """One reading: the real temperature plus noise, maybe a spike"""
+    value = t + random.gauss(0, opts.noise)
+    if random.random() < opts.spikes:
+        value += random.choice((-1, 1)) * opts.spike_size
+    return value
+
+
+def load(path):
+    """Readings and true temperatures from a recorded trace"""
+    readings, truth = [], []
+    for line in open(path):
+        parts = line.split()
+        if not parts or line.startswith('#'):
+            continue
+        readings.append(float(parts[0]))
+        truth.append(float(parts[1]) if len(parts) > 1 else None)
+    if None in truth:
+        # smooth it out instead, 16 readings each way
+        truth = []
+        for i in range(len(readings)):
+            window = readings[max(0, i - 16):i + 17]
+            truth.append(sum(window) / len(window))
+    return readings, truth
+
+
+def run(harness, readings):
+    """Filtered, projected, and legacy projected values, in 13.2 C"""
+    text = '\n'.join(str(int(round(r * 4))) for r in readings) + '\n'
+    out = subprocess.check_output([harness], input=text.encode()).decode()
+    return [[int(x) for x in line.split()] for line in out.splitlines()]
+
+
+def stepdowns(projected, ceil):
+    """Which readings crescendo would step down on"""
+    steps = []
+    count = 0
+    for i, p in enumerate(projected):
+        if p >= (ceil << 2):
+            if count > THERM_LOWPASS:
+                count = 0
+                steps.append(i)
+            else:
+                count += 1
+        else:
+            count = 0
+    return steps
+
+
+def false_steps(steps, truth, ceil, horizon):
+    return len([i for i in steps if max(truth[i:i + horizon + 1]) < ceil])
+
+
+def lead(steps, truth, ceil):
+    """Readings between the first step-down and really crossing the ceiling"""
+    crossed = [i for i, t in enumerate(truth) if t >= ceil]
+    if not steps or not crossed:
+        return None
+    return crossed[0] - steps[0]
+
+
+def report(results, opts):
+    print('%-16s %14s %14s %16s %16s' % ('trace', 'false (old)', 'false (new)',
+                                         'lead (old)', 'lead (new)'))
+    false_new = 0
+    missed = 0
+    for name in results:
+        f_old, f_new, l_old, l_new, hot = results[name]
+        false_new += f_new
+        if hot:
+            missed += l_new.count(None)
+        print('%-16s %14i %14i %16s %16s' % (name, f_old, f_new,
+                                             leads(l_old), leads(l_new)))
+    print('(lead: readings before really crossing %iC, average of runs)' %
+          opts.ceil)
+
+    if false_new:
+        print('ERROR: %i false step-down(s)' % false_new)
+        return 1
+    if missed:
+        print('ERROR: %i overheating trace(s) never stepped down' % missed)
+        return 1
+    return 0
+
+
+def leads(values):
+    if not values:
+        return '-'
+    hits = [v for v in values if v is not None]
+    if not hits:
+        return 'missed'
+    text = '%.0f' % (sum(hits) / float(len(hits)))
+    if len(hits) < len(values):
+        text += ' (%i missed)' % (len(values) - len(hits))
+    return text
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
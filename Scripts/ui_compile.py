@@ -0,0 +1,225 @@
+#!/usr/bin/env python
+
+import os
+import re
+import sys
+import argparse
+
+
+EVENTS = ['tap', 'timeout', 'long']  # same order as the table columns
+STAY = 31      # "next state" value which means don't change state
+MAX_ACTIONS = 7
+MAX_TAPS = 31  # fast presses are counted in 5 bits
+
+
+class UIError(Exception):
+    pass
+
+
+def main(args):
+    """Compile a UI/*.ui transition table into a header for tk-ui.h
+    Reads the states, events, actions, and transitions, checks that every
+    state can be reached from the first one and that none of them is a dead
+    end (where taps and timeouts never lead anywhere else), then writes
+    the packed PROGMEM table and a few #defines for the firmware.
+    """
+    parser = argparse.ArgumentParser(description=main.__doc__.split('\n')[0])
+    parser.add_argument('ui', help='UI description, like UI/crescendo.ui')
+    parser.add_argument('header', nargs='?',
+                        help='header to write (default: print it)')
+    opts = parser.parse_args(args)
+
+    try:
+        ui = parse(open(opts.ui).read())
+        check(ui)
+    except (IOError, UIError) as e:
+        print('ERROR: %s: %s' % (opts.ui, e))
+        return 1
+
+    text = header(ui, opts.ui)
+    if opts.header:
+        # don't touch it if nothing changed, so make doesn't rebuild
+        if not os.path.exists(opts.header) or open(opts.header).read() != text:
+            with open(opts.header, 'w') as fp:
+                fp.write(text)
+        print('%s: %i states, %i bytes' % (opts.ui, len(ui['states']), size(ui)))
+    else:
+        sys.stdout.write(text)
+    return 0
+
+
+def parse(text):
+    ui = {'actions': [], 'states': [], 'modes': {}, 'rows': {}, 'taps': {}}
+    for num, line in enumerate(text.splitlines(), 1):
+        words = line.split('#')[0].split()
+        if not words:
+            continue
+        try:
+            parse_line(ui, words)
+        except UIError as e:
+            raise UIError('line %i: %s' % (num, e))
+    return ui
+
+
+def parse_line(ui, words):
+    if words[0] == 'action':
+        if len(words) != 2:
+            raise UIError('expected "action <name>"')
+        name = words[1]
+        if not re.match(r'[a-z_][a-z0-9_]*$', name) or name in ui['actions']:
+            raise UIError('bad or duplicate action "%s"' % name)
+        ui['actions'].append(name)
+        if len(ui['actions']) > MAX_ACTIONS:
+            raise UIError('more than %i actions' % MAX_ACTIONS)
+
+    elif words[0] == 'state':
+        if len(words) != 3:
+            raise UIError('expected "state <name> <MODE>"')
+        name, mode = words[1:]
+        if not re.match(r'[a-z_][a-z0-9_]*$', name) or name in ui['modes']:
+            raise UIError('bad or duplicate state "%s"' % name)
+        if not re.match(r'[A-Z_][A-Z0-9_]*$', mode):
+            raise UIError('mode "%s" should be a macro from the firmware' % mode)
+        ui['states'].append(name)
+        ui['modes'][name] = mode
+        if len(ui['states']) >= STAY:
+            raise UIError('more than %i states' % (STAY - 1))
+
+    else:
+        if len(words) != 4:
+            raise UIError('expected "<state> <event> <action> <next>"')
+        state, event, action, nxt = words
+        if state != '*' and state not in ui['modes']:
+            raise UIError('unknown state "%s"' % state)
+        if action != '-' and action not in ui['actions']:
+            raise UIError('unknown action "%s"' % action)
+        if nxt != '-' and nxt not in ui['modes']:
+            raise UIError('unknown state "%s"' % nxt)
+        taps = re.match(r'taps(\d+)$', event)
+        if taps:
+            count = int(taps.group(1))
+            if state != '*':
+                raise UIError('fast taps only work from any state ("*")')
+            if not 2 <= count <= MAX_TAPS:
+                raise UIError('taps should be 2 to %i' % MAX_TAPS)
+            if nxt == '-':
+                raise UIError('fast taps need somewhere to go')
+            key, table = count, ui['taps']
+        elif event in EVENTS:
+            key, table = (state, event), ui['rows']
+        else:
+            raise UIError('unknown event "%s"' % event)
+        if key in table:
+            raise UIError('"%s %s" is already defined' % (state, event))
+        table[key] = (action, nxt)
+
+
+def transition(ui, state, event):
+    """(action, next state) for an event, or None if nothing happens"""
+    t = ui['rows'].get((state, event)) or ui['rows'].get(('*', event))
+    if t is None:
+        return None
+    action, nxt = t
+    return action, (state if nxt == '-' else nxt)
+
+
+def check(ui):
+    if not ui['states']:
+        raise UIError('no states')
+
+    # everything should be reachable from the first state
+    seen, todo = set(), [ui['states'][0]]
+    todo += [nxt for _, nxt in ui['taps'].values()]
+    while todo:
+        state = todo.pop()
+        if state in seen:
+            continue
+        seen.add(state)
+        for event in EVENTS:
+            t = transition(ui, state, event)
+            if t:
+                todo.append(t[1])
+    lost = [s for s in ui['states'] if s not in seen]
+    if lost:
+        raise UIError('unreachable state(s): %s' % ' '.join(lost))
+
+    # ... and nothing should trap the user until the light is turned off
+    for state in ui['states']:
+        exits = [transition(ui, state, e) for e in ('tap', 'timeout')]
+        if not [t for t in exits if t and t[1] != state]:
+            raise UIError('dead end: nothing but a long press leaves "%s"' % state)
+    if not transition(ui, ui['states'][0], 'long'):
+        raise UIError('no "long" transition, so the light never starts')
+
+    used = set(a for a, _ in ui['rows'].values()) | \
+           set(a for a, _ in ui['taps'].values())
+    for action in ui['actions']:
+        if action not in used:
+            print('WARNING: action "%s" is never used' % action)
+
+
+def pack(ui, t):
+    if t is None:
+        return STAY
+    action, nxt = t
+    code = 0 if action == '-' else ui['actions'].index(action) + 1
+    return (code << 5) | (STAY if nxt == '-' else ui['states'].index(nxt))
+
+
+def size(ui):
+    return 4 * len(ui['states']) + (2 * len(ui['taps']) + 1 if ui['taps'] else 0)
+
+
+def header(ui, source):
+    out = ['// Generated by Scripts/ui_compile.py from %s, edit that instead'
+           % source.replace(os.sep, '/'),
+           '#ifndef UI_COMPILED_H',
+           '#define UI_COMPILED_H',
+           '']
+
+    modes = []
+    for state in ui['states']:
+        if ui['modes'][state] not in modes:
+            modes.append(ui['modes'][state])
+    for mode in modes:
+        out += ['#ifndef %s' % mode,
+                'Hey, the UI uses %s, which is turned off.' % mode,
+                '#endif']
+    out.append('')
+
+    out.append('#define UI_COUNT %i' % len(ui['states']))
+    out.append('#define UI_START 0  // %s' % ui['states'][0])
+    for i, action in enumerate(ui['actions']):
+        out.append('#define UI_ACT_%s %i' % (action, i + 1))
+    # first state with each mode, for code which jumps to a mode directly
+    for mode in modes:
+        first = [s for s in ui['states'] if ui['modes'][s] == mode][0]
+        out.append('#define UI_FIRST_%s %i  // %s' %
+                   (mode, ui['states'].index(first), first))
+    out.append('')
+
+    out.append('// mode, then (action << 5) | next state for: %s' % ', '.join(EVENTS))
+    out.append('// (next state %i means stay)' % STAY)
+    out.append('#define UI_STATE_TABLE \\')
+    for i, state in enumerate(ui['states']):
+        codes = ['0x%02x' % pack(ui, ui['rows'].get((state, e)) or
+                                     ui['rows'].get(('*', e)))
+                 for e in EVENTS]
+        out.append('    %s, %s,  /* %2i %s */ \\' %
+                   (ui['modes'][state], ', '.join(codes), i, state))
+    out.append('')
+
+    if ui['taps']:
+        out.append('// fast taps: count, (action << 5) | next state; 0 ends it')
+        out.append('#define UI_TAPS_TABLE \\')
+        for count in sorted(ui['taps']):
+            out.append('    %i, 0x%02x, \\' % (count, pack(ui, ui['taps'][count])))
+        out.append('    0')
+        out.append('')
+
+    out.append('#endif  // UI_COMPILED_H')
+    return '\n'.join(out) + '\n'
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
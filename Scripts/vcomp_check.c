@@ -0,0 +1,109 @@
+/*
+ * Runs tk-vcomp.h with tk-softstart.h on the host, the way bistro uses
+ * them, and checks that voltage compensation actually reaches the output.
+ * Scripts/vcomp_check.py builds and runs this.
+ *
+ * Simulates bistro's main loop on a steady level: set_mode(), half a second
+ * of delay ticks, then a new voltage reading for vcomp_update(), while the
+ * battery runs down from ADC_42 to below ADC_LOW.  Prints one line per
+ * loop ("voltage factor pwm") and exits 1 if the FET duty doesn't follow
+ * the voltage, if the factor jumps (by more than VCOMP_SLEW in one update,
+ * like when it backs off at ADC_LOW) or never finishes backing off, or if
+ * a fade between levels stops working.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define VOLTAGE_COMP
+#define SOFT_START
+#include "../tk-calibration.h"
+#include "../tk-vcomp.h"
+#include "../tk-softstart.h"
+
+// a FET ramp, like driver_config_bistro.h's
+const uint8_t ramp_FET[] = { 0, 2, 5, 11, 22, 39, 65, 98, 137, 184, 255 };
+#define RAMP_SIZE sizeof(ramp_FET)
+#define STEADY 8  // compensation has headroom here
+
+uint8_t pwm;  // what's on the FET channel
+
+void set_level(uint8_t level) {
+    // same as bistro's, minus the 7135 channel
+    soft_now = level;
+    pwm = level ? vcomp(ramp_FET[level - 1]) : 0;
+}
+
+void loop(uint8_t level, uint8_t voltage) {
+    // bistro's main loop, for a regular solid mode
+    uint8_t ms;
+    set_mode(level);
+    for (ms = 0; ms < 500/4; ms++) soft_tick(4);
+    vcomp_update(voltage);
+}
+
+int main() {
+    uint8_t v, i, first = 0, peak = 0, errors = 0;
+    uint8_t last, jump = 0, jump_v = 0;
+
+    set_level(STEADY);
+    // settle at a full battery, then let it run down, and stay low long
+    // enough for the factor to get all the way back to 1x
+    for (i = 0; i < 32; i++) loop(STEADY, ADC_42);
+    last = vcomp_factor;
+    for (v = ADC_42; v > ADC_LOW - 4; v--) {
+        for (i = 0; i < ((v == ADC_LOW - 3) ? 64 : 8); i++) {
+            loop(STEADY, v);
+            printf("%d %d %d\n", v, vcomp_factor, pwm);
+            if (pwm > peak) peak = pwm;
+            if (abs(vcomp_factor - last) > jump) {
+                jump = abs(vcomp_factor - last);
+                jump_v = v;
+            }
+            last = vcomp_factor;
+        }
+        if (v == ADC_42) first = pwm;
+    }
+    if (peak <= first) {
+        printf("ERROR: FET duty stayed at %d as the voltage fell\n", first);
+        errors ++;
+    }
+    if (jump > VCOMP_SLEW) {
+        printf("ERROR: factor jumped by %d in one update, at voltage %d\n",
+               jump, jump_v);
+        errors ++;
+    }
+    if (vcomp_factor != 128) {
+        printf("ERROR: factor is still %d below ADC_LOW\n", vcomp_factor);
+        errors ++;
+    }
+
+    // a fade still takes several steps, and ends at the target
+    set_mode(STEADY - 5);
+    if (soft_now == STEADY - 5) {
+        printf("ERROR: set_mode() jumped instead of fading\n");
+        errors ++;
+    }
+    loop(STEADY - 5, ADC_LOW);
+    if (soft_now != STEADY - 5) {
+        printf("ERROR: fade ended at %d instead of %d\n", soft_now, STEADY - 5);
+        errors ++;
+    }
+    return errors ? 1 : 0;
+}
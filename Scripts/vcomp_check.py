@@ -0,0 +1,60 @@
+#!/usr/bin/env python
+
+import os
+import sys
+import shutil
+import argparse
+import tempfile
+import subprocess
+
+
+here = os.path.dirname(os.path.abspath(__file__))
+
+
+def main(args):
+    """Checks that VOLTAGE_COMP reaches the output, with SOFT_START too.
+    Builds Scripts/vcomp_check.c (tk-vcomp.h and tk-softstart.h, used the
+    way bistro uses them) with the host compiler and runs it: the FET duty
+    on a steady level has to rise as the battery runs down.
+    """
+    parser = argparse.ArgumentParser(description=main.__doc__.split('\n')[0])
+    parser.add_argument('-v', '--verbose', action='store_true',
+                        help='show "voltage factor pwm" for each loop')
+    parser.add_argument('-D', dest='defines', action='append', default=[],
+                        help='passed to the compiler, like VCOMP_MAX=200')
+    opts = parser.parse_args(args)
+
+    if not shutil.which('cc'):
+        print('ERROR: cc not found')
+        return 1
+
+    work = tempfile.mkdtemp(prefix='vcomp-check-')
+    try:
+        out = os.path.join(work, 'vcomp_check')
+        cmd = ['cc', '-O2', '-o', out, os.path.join(here, 'vcomp_check.c')]
+        cmd += ['-D' + d for d in opts.defines]
+        if subprocess.call(cmd):
+            print('ERROR: could not build vcomp_check.c')
+            return 1
+        proc = subprocess.Popen([out], stdout=subprocess.PIPE)
+        text = proc.communicate()[0].decode()
+    finally:
+        shutil.rmtree(work)
+
+    lines = text.splitlines()
+    errors = [l for l in lines if l.startswith('ERROR')]
+    rows = [l.split() for l in lines if not l.startswith('ERROR')]
+    if opts.verbose:
+        for row in rows:
+            print('%4s %4s %4s' % tuple(row))
+    if rows:
+        peak = max(rows, key=lambda r: int(r[2]))
+        print('FET duty %s at voltage %s, up to %s at voltage %s' %
+              (rows[0][2], rows[0][0], peak[2], peak[0]))
+    for e in errors:
+        print(e)
+    return 1 if (errors or proc.returncode) else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
@@ -64,13 +64,27 @@
 #define USE_DELAY_S         // Also use _delay_s(), not just _delay_ms()
 
 #include "tk-attiny.h"
+#ifdef SOFT_START
+#define DELAY_HOOK soft_tick  // transitions move along while we wait
+#endif
 #include "tk-delay.h"
+#ifdef SOFT_START
+#include "tk-softstart.h"
+#endif
 #include "tk-voltage.h"
 
 #ifdef RANDOM_STROBE
 #include "tk-random.h"
 #endif
 
+#ifdef NUM_USER_GROUPS
+#include "tk-usergroups.h"
+#endif
+#ifdef GROUP_PROGRAM_MODE
+#include "tk-taps.h"
+#endif
+#include "tk-sleep.h"
+
 /*
  * global variables
  */
@@ -115,6 +129,23 @@ uint8_t g_u8solid_modes;
 //PROGMEM const uint8_t hiddenmodes[] = { HIDDENMODES };
 // default values calculated by group_calc.py
 // Each group must be 8 values long, but can be cut short with a zero.
+#ifdef NUM_USER_GROUPS
+// (the first NUM_USER_GROUPS can be reprogrammed, which leaves more room
+//  for code than a built-in group for every combination)
+#define NUM_MODEGROUPS (4u)
+#if (NUM_USER_GROUPS > NUM_MODEGROUPS)
+Hey, NUM_USER_GROUPS is more than NUM_MODEGROUPS.
+#endif
+PROGMEM const uint8_t modegroups[] = {
+//    1,  2,  3,  5,  7,  POLICE_STROBE, BIKING_STROBE, BATTCHECK,
+    1,  2,  3,  5,  7,  0,  0,  0,  // user group A (default)
+//    2,  4,  7,  POLICE_STROBE, BIKING_STROBE, BATTCHECK, SOS,  0,
+    2,  4,  7,  0,  0,  0,  0,  0,  // user group B (default)
+    7,  5,  3,  2,  1,  0,  0,  0,
+//    7,  4,  POLICE_STROBE,  0,  0,  0,  0,  0,
+    7,  0,
+};
+#else
 #define NUM_MODEGROUPS (8u)
 PROGMEM const uint8_t modegroups[] = {
 //    1,  2,  3,  5,  7,  POLICE_STROBE, BIKING_STROBE, BATTCHECK,
@@ -130,6 +161,7 @@ PROGMEM const uint8_t modegroups[] = {
 //    7,  4,  POLICE_STROBE,  0,  0,  0,  0,  0,
     7,  0,
 };
+#endif
 uint8_t g_u8modes[8u];  // make sure this is long enough...
 
 // Modes (gets set when the light starts up based on saved config values)
@@ -158,6 +190,7 @@ void save_mode() {  // save the current mode index (with wear leveling)
 //#define OPT_offtim3 (EEPSIZE-4)
 //#define OPT_maxtemp (EEPSIZE-5)
 #define OPT_mode_override (EEPSIZE-3)
+#define OPT_chem (EEPSIZE-13)  // CHEM_LIION, CHEM_LIFEPO4...
 //#define OPT_moon (EEPSIZE-7)
 //#define OPT_revmodes (EEPSIZE-8)
 void save_state() {  // central method for writing complete state
@@ -184,6 +217,10 @@ void reset_state() {
     g_u8modegroup = 0;
     g_u8mode_override = 0;
     save_state();
+#ifdef NUM_USER_GROUPS
+    uint8_t i;
+    for(i=0; i<NUM_USER_GROUPS; i++) usergroup_begin(i);
+#endif
 }
 #endif
 
@@ -241,6 +278,10 @@ void restore_state() {
 
 #ifndef USE_FIRSTBOOT
     if (g_u8modegroup >= NUM_MODEGROUPS) reset_state();
+#else
+    // a stray value (or one from a build with more groups) would read
+    // past the end of the table, or program a group which doesn't exist
+    if (g_u8modegroup >= NUM_MODEGROUPS) g_u8modegroup = 0;
 #endif
 }
 
@@ -292,9 +333,21 @@ void count_modes() {
     // No, how about actually counting the g_u8modes instead?
     // (in case anyone changes the mode groups above so they don't form a triangle)
     uint8_t count;
-    for (count=0; (count<8) && pgm_read_byte(src); count++, src++ )
+    uint8_t level;
+#ifdef NUM_USER_GROUPS
+    // use the user's version of this group, if there is one
+    // (biscotti has no hidden modes, so the rest of the flags don't matter)
+    uint8_t user = ! (usergroup_flags(g_u8modegroup) & USERGROUP_EMPTY);
+#endif
+    for (count=0; count<8; count++, src++ )
     {
-        *dest++ = pgm_read_byte(src);
+#ifdef NUM_USER_GROUPS
+        if (user) level = usergroup_level(g_u8modegroup, count);
+        else
+#endif
+        level = pgm_read_byte(src);
+        if (! level) break;
+        *dest++ = level;
     }
     g_u8solid_modes = count;
 
@@ -358,6 +411,9 @@ void set_output(uint8_t pwm1) {
 }
 
 void set_level(uint8_t level) {
+#ifdef SOFT_START
+    soft_now = level;
+#endif
     TCCR0A = PHASE;
     if (level == 0) {
         //set_output(0,0);
@@ -381,24 +437,8 @@ void set_level(uint8_t level) {
     }
 }
 
-#ifdef SOFT_START
-void set_mode(uint8_t mode) {
-    static uint8_t actual_level = 0;
-    uint8_t target_level = mode;
-    int8_t shift_amount;
-    int8_t diff;
-    do {
-        diff = target_level - actual_level;
-        shift_amount = (diff >> 2) | (diff!=0);
-        actual_level += shift_amount;
-        set_level(actual_level);
-        //_delay_ms(RAMP_SIZE/20);  // slow ramp
-        _delay_ms(RAMP_SIZE/4);  // fast ramp
-    } while (target_level != actual_level);
-}
-#else // SOFT_START
+#ifndef SOFT_START
 #  define set_mode set_level
-//set_level(mode);
 #endif  // SOFT_START
 
 void blink(uint8_t val, uint8_t speed)
@@ -463,15 +503,30 @@ void toggle(uint8_t *var, uint8_t num) {
     _delay_s();
 }
 
+#ifdef GROUP_PROGRAM_MODE
+// which slot the programming ramp is picking a level for
+#define GP_SLOT(n) (0x10 + (n))
+// how long each pass of the programming ramp takes, in 4ms units
+#define GP_RAMP_TIME (3000/4)
+
+void clear_override() {
+    // leave a one-shot mode without doing a full save_state()
+    g_u8mode_idx = 0;
+    g_u8mode_override = 0;
+    save_mode();
+    eeprom_write_byte((uint8_t *)OPT_mode_override, 0);
+}
+#endif
+
 #ifdef TEMPERATURE_MON
 uint8_t get_temperature() {
     ADC_on_temperature();
     // average a few values; temperature is noisy
     uint16_t temp = 0;
     uint8_t i;
-    get_voltage();
+    read_adc_8bit();
     for(i=0; i<16; i++) {
-        temp += get_voltage();
+        temp += read_adc_8bit();
         _delay_4ms(1);
     }
     temp >>= 4;
@@ -524,6 +579,9 @@ int main(void)
 
     // Read config values and saved state
     restore_state();
+#ifdef CHEM_SELECT
+    chem_select(eeprom_read_byte((uint8_t *)OPT_chem));
+#endif
 
     // Enable the current mode group
     count_modes();
@@ -536,6 +594,11 @@ int main(void)
     //  so let's not wait until it decays to reset it)
     //if (g_u8fast_presses > 0x20) { g_u8fast_presses = 0; }
 
+#ifdef GROUP_PROGRAM_MODE
+    // is this a tap while programming a group?
+    uint8_t group_prog = 0;
+#endif
+
     // check button press time, unless the mode is overridden
     if (! g_u8mode_override) {
 #ifdef OFFTIM3
@@ -543,10 +606,19 @@ int main(void)
 #else
         if (! g_u8long_press) {
 #endif
-            // Indicates they did a short press, go to the next mode
-            // We don't care what the g_u8fast_presses value is as long as it's over 15
-            g_u8fast_presses = (g_u8fast_presses+1) & 0x1f;
-            next_mode(); // Will handle wrap arounds
+#ifdef GROUP_PROGRAM_MODE
+            if (tap_armed()) {
+                // picking a level, not changing modes
+                group_prog = 1;
+                g_u8fast_presses = 0;
+            } else
+#endif
+            {
+                // Indicates they did a short press, go to the next mode
+                // We don't care what the g_u8fast_presses value is as long as it's over 15
+                g_u8fast_presses = (g_u8fast_presses+1) & 0x1f;
+                next_mode(); // Will handle wrap arounds
+            }
 #ifdef OFFTIM3
         } else if (cap_val > CAP_MED) {
             // User did a medium press, go back one mode
@@ -569,7 +641,15 @@ int main(void)
         }
     }
     g_u8long_press = 0;
+#ifdef GROUP_PROGRAM_MODE
+    if (! group_prog) {
+        // anything other than a tap ends the programming sequence
+        tap_disarm();
+        save_mode();
+    }
+#else
     save_mode();
+#endif
 
 #ifdef CAP_PIN
     // Charge up the capacitor by setting CAP_PIN to output
@@ -606,6 +686,11 @@ int main(void)
         g_u8fast_presses = 0;
         output = g_u8mode_idx;
     }
+#ifdef GROUP_PROGRAM_MODE
+    if (group_prog) {
+        output = GROUP_PROGRAM_MODE;
+    }
+#endif
     while (1) {
         if (g_u8fast_presses > 9) {  // Config mode
             _delay_s();       // wait for user to stop fast-pressing button
@@ -625,6 +710,15 @@ int main(void)
 
             toggle(&g_u8memory, 2);
 
+#ifdef GROUP_PROGRAM_MODE
+            // Program the levels in the current group?
+            if (g_u8modegroup < NUM_USER_GROUPS) {
+                g_u8mode_idx = GROUP_PROGRAM_MODE;
+                toggle(&g_u8mode_override, 3);
+                g_u8mode_idx = 0;
+            }
+#endif
+
 #ifdef OFFTIM3
             toggle(&g_u8offtim3, 6);
 #endif
@@ -674,20 +768,20 @@ int main(void)
             // normal version
             for(i=0; i<4; i++) {
                 //set_output(255,0);
-                set_mode(RAMP_SIZE);
+                set_level(RAMP_SIZE);
                 _delay_4ms(3);
                 //set_output(0,255);
-                set_mode(4);
+                set_level(4);
                 _delay_4ms(15);
             }
             //_delay_ms(720);
             _delay_s();
 #else
             // small/minimal version
-            set_mode(RAMP_SIZE);
+            set_level(RAMP_SIZE);
             //set_output(255,0);
             _delay_4ms(8);
-            set_mode(3);
+            set_level(3);
             //set_output(0,255);
             _delay_s();
 #endif
@@ -748,6 +842,45 @@ int main(void)
             }
             _delay_s();
         }
+#ifdef GROUP_PROGRAM_MODE
+        else if (output == GROUP_PROGRAM_MODE) {
+            // The light ramps up; tap at the level you want for each mode.
+            // Let it ramp all the way up twice without tapping to finish.
+            uint8_t slot = 0;
+            uint8_t pass, level;
+            if (g_u8mode_override) {
+                // just got here from config mode
+                clear_override();
+                usergroup_begin(g_u8modegroup);
+            } else {
+                // tapped: keep the level the ramp was at
+                slot = tap_armed() - GP_SLOT(0);
+                usergroup_set_level(g_u8modegroup, slot, g_u8tap_val);
+                blink(1, BLINK_SPEED/8);  // acknowledge the tap
+                slot ++;
+            }
+            if (slot < 8) {
+                _delay_4ms(BLINK_SPEED);
+                for(pass=0; pass<2; pass++) {
+                    for(level=1; level<=RAMP_SIZE; level++) {
+                        tap_arm(GP_SLOT(slot), level);
+                        set_level(level);
+                        _delay_4ms(GP_RAMP_TIME/RAMP_SIZE);
+                    }
+                    set_level(0);
+                    _delay_4ms(BLINK_SPEED);
+                }
+            }
+            // no tap (or no room for more), so that's the whole group
+            tap_disarm();
+            usergroup_finish(g_u8modegroup, slot, 0);
+            count_modes();
+            blink(2, BLINK_SPEED/8);  // confirm
+            g_u8mode_idx = 0;
+            output = g_u8modes[g_u8mode_idx];
+            actual_level = output;
+        }
+#endif  // GROUP_PROGRAM_MODE
 #ifdef TEMP_CAL_MODE
         else if (output == TEMP_CAL_MODE) {
             // make sure we don't stay in this mode after button press
@@ -808,7 +941,8 @@ int main(void)
         g_u8fast_presses = 0;
 #ifdef VOLTAGE_MON
         if (ADCSRA & (1 << ADIF)) {  // if a voltage reading is ready
-            voltage = ADCH;  // get the waiting value
+            // (not ADCH, which only works with a divider)
+            voltage = get_voltage();
             // See if voltage is lower than what we were looking for
             if (voltage < ADC_LOW) {
                 lowbatt_cnt ++;
@@ -825,19 +959,13 @@ int main(void)
                     actual_level = RAMP_SIZE / 2;
                 } else if (actual_level > 1) {  // regular solid mode
                     // step down from solid g_u8modes somewhat gradually
-                    // drop by 25% each time
-                    //actual_level = (actual_level >> 2) + (actual_level >> 1);
-                    actual_level = actual_level - 1;
-                    // drop by 50% each time
-                    //actual_level = (actual_level >> 1);
+                    // (by the battery profile's step each time)
+                    actual_level = lvp_step(actual_level);
                 } else { // Already at the lowest mode
                     //g_u8mode_idx = 0;  // unnecessary; we never leave this clause
                     //actual_level = 0;  // unnecessary; we never leave this clause
-                    // Turn off the light
-                    set_level(0);
-                    // Power down as many components as possible
-                    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
-                    sleep_mode();
+                    // Turn off the light and power down everything
+                    shutdown();
                 }
                 set_mode(actual_level);
                 output = actual_level;
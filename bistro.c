@@ -69,14 +69,42 @@
 #define OWN_DELAY           // Don't use stock delay functions.
 #define USE_DELAY_MS        // Also use _delay_ms()
 #define USE_DELAY_S         // Also use _delay_s()
+#ifdef SOFT_START
+#define DELAY_HOOK soft_tick  // transitions move along while we wait
+#endif
 #include "tk-delay.h"
 
+#ifdef SOFT_START
+#include "tk-softstart.h"
+#endif
+
 #include "tk-voltage.h"
 
+#ifdef TEMP_CAL_MODE
+// get_temp() is only about 4 C per step, so save every step
+#define THERMCAL_MIN_DELTA 1
+#include "tk-thermcal.h"
+#endif
+
 #ifdef RANDOM_STROBE
 #include "tk-random.h"
 #endif
 
+#include "tk-taps.h"
+#include "tk-sleep.h"
+
+#ifdef NUM_USER_GROUPS
+#include "tk-usergroups.h"
+#endif
+
+#ifdef STACK_CHECK
+#include "tk-stackcheck.h"
+#endif
+
+#ifdef OTC_MODEL
+#include "tk-otc.h"
+#endif
+
 /*
  * global variables
  */
@@ -87,7 +115,12 @@
 #define FIRSTBOOT 0b01010101
 uint8_t g_u8firstboot = FIRSTBOOT;  // detect initial boot or factory reset
 #endif
-uint8_t g_u8modegroup = 5;     // which mode group (set above in #defines)
+#ifdef NUM_USER_GROUPS
+#define DEFAULT_MODEGROUP 0  // user group A
+#else
+#define DEFAULT_MODEGROUP 5  // the 6-mode group
+#endif
+uint8_t g_u8modegroup = DEFAULT_MODEGROUP;     // which mode group (set above in #defines)
 uint8_t enable_moon = 1;   // Should we add moon to the set of g_u8modes?
 uint8_t reverse_modes = 0; // flip the mode order?
 uint8_t g_u8memory = 0;        // mode g_u8memory, or not (set via soldered star)
@@ -120,6 +153,21 @@ uint8_t g_u8solid_modes;
 PROGMEM const uint8_t hiddenmodes[] = { HIDDENMODES };
 // default values calculated by group_calc.py
 // Each group must be 8 values long, but can be cut short with a zero.
+#ifdef NUM_USER_GROUPS
+// (the first NUM_USER_GROUPS can be reprogrammed, so there's no need
+//  for a built-in group for every possible number of modes)
+#define NUM_MODEGROUPS 6  // don't count muggle mode
+#if (NUM_USER_GROUPS > NUM_MODEGROUPS)
+Hey, NUM_USER_GROUPS is more than NUM_MODEGROUPS.
+#endif
+PROGMEM const uint8_t modegroups[] = {
+    11, 23, 36, 50, 64,  0,  0,  0,  // 1: user group A (default)
+    11, 35, 64,  0,  0,  0,  0,  0,  // 2: user group B (default)
+    11, 20, 31, 41, 53, 64,  0,  0,
+    29, 64,POLICE_STROBE,0,0,0,0,0,  // 4: special group A
+    BIKING_STROBE,BATTCHECK,11,29,64,0,0,0,  // 5: special group B
+    9, 18, 29, 46, 64,  0,  0,  0,  // 6: special group C
+#else
 #define NUM_MODEGROUPS 9  // don't count muggle mode
 PROGMEM const uint8_t modegroups[] = {
     64,  0,  0,  0,  0,  0,  0,  0,
@@ -131,6 +179,7 @@ PROGMEM const uint8_t modegroups[] = {
     29, 64,POLICE_STROBE,0,0,0,0,0,  // 7: special group A
     BIKING_STROBE,BATTCHECK,11,29,64,0,0,0,  // 8: special group B
     9, 18, 29, 46, 64,  0,  0,  0,  // 9: special group C
+#endif
     11, 29, 50,  0,                  // muggle mode, exception to "must be 8 bytes long"
 };
 //uint8_t g_u8modes[] = { 1,2,3,4,5,6,7,8,9, HIDDENMODES };  // make sure this is long enough...
@@ -158,6 +207,9 @@ void save_mode() {  // save the current mode index (with wear leveling)
 #define OPT_moon (EEPSIZE-7)
 #define OPT_revmodes (EEPSIZE-8)
 #define OPT_muggle (EEPSIZE-9)
+#define OPT_stack (EEPSIZE-10)
+#define OPT_otc (EEPSIZE-12)  // 2 bytes, see tk-otc.h
+#define OPT_chem (EEPSIZE-13)  // CHEM_LIION, CHEM_LIFEPO4...
 void save_state() {  // central method for writing complete state
     save_mode();
 #ifdef USE_FIRSTBOOT
@@ -180,7 +232,7 @@ void save_state() {  // central method for writing complete state
 #ifndef USE_FIRSTBOOT
 static inline void reset_state() {
     g_u8mode_idx = 0;
-    g_u8modegroup = 5;
+    g_u8modegroup = DEFAULT_MODEGROUP;
     save_state();
 }
 #endif
@@ -195,6 +247,10 @@ void restore_state() {
         // not much to do; the defaults should already be set
         // while defining the variables above
         save_state();
+#ifdef NUM_USER_GROUPS
+        // factory reset also resets the user's groups
+        for(eep=0; eep<NUM_USER_GROUPS; eep++) usergroup_begin(eep);
+#endif
         return;
     }
 #else
@@ -240,6 +296,10 @@ void restore_state() {
 
 #ifndef USE_FIRSTBOOT
     if (g_u8modegroup >= NUM_MODEGROUPS) reset_state();
+#else
+    // a stray value (or one from a build with more groups) would read
+    // past the end of the table, or program a group which doesn't exist
+    if (g_u8modegroup >= NUM_MODEGROUPS) g_u8modegroup = DEFAULT_MODEGROUP;
 #endif
 }
 
@@ -285,6 +345,9 @@ void count_modes() {
     uint8_t my_modegroup = g_u8modegroup;
     uint8_t my_enable_moon = enable_moon;
     uint8_t my_reverse_modes = reverse_modes;
+    uint8_t flags = 0xff;  // built-in groups get all hidden modes
+    uint8_t level;
+    uint8_t i;
 
     // override config if we're in simple mode
     if (muggle_mode) {
@@ -296,6 +359,11 @@ void count_modes() {
     uint8_t *dest;
     const uint8_t *src = modegroups + (my_modegroup<<3);
     dest = g_u8modes;
+#ifdef NUM_USER_GROUPS
+    // use the user's version of this group, if there is one
+    uint8_t user = usergroup_flags(my_modegroup);
+    if (! (user & USERGROUP_EMPTY)) flags = user;
+#endif
 
     // add moon mode (or not) if config says to add it
     if (my_enable_moon) {
@@ -307,45 +375,40 @@ void count_modes() {
     //g_u8solid_modes = g_u8modegroup + 1;  // Assume group N has N g_u8modes
     // No, how about actually counting the g_u8modes instead?
     // (in case anyone changes the mode groups above so they don't form a triangle)
-    for(g_u8solid_modes=0;
-            (g_u8solid_modes<8) && pgm_read_byte(src);
-            g_u8solid_modes++, src++ )
-    {
-        *dest++ = pgm_read_byte(src);
+    for(g_u8solid_modes=0; g_u8solid_modes<8; g_u8solid_modes++, src++) {
+#ifdef NUM_USER_GROUPS
+        if (! (user & USERGROUP_EMPTY))
+            level = usergroup_level(my_modegroup, g_u8solid_modes);
+        else
+#endif
+        level = pgm_read_byte(src);
+        if (! level) break;
+        *dest++ = level;
+    }
+    if (my_enable_moon) g_u8solid_modes ++;
+
+    // reverse the solid modes (and moon) in place
+    if (my_reverse_modes) {
+        for(i=0; i<(g_u8solid_modes>>1); i++) {
+            level = g_u8modes[i];
+            g_u8modes[i] = g_u8modes[g_u8solid_modes-1-i];
+            g_u8modes[g_u8solid_modes-1-i] = level;
+        }
     }
 
-    // add regular g_u8modes
-    //memcpy_P(dest, src, g_u8solid_modes);  // was already copied above
     // add hidden g_u8modes
     //memcpy_P(dest + g_u8solid_modes, hiddenmodes, sizeof(hiddenmodes));
     // smaller than memcpy_p()
-    for( src=hiddenmodes; src<hiddenmodes+sizeof(hiddenmodes); src++ )
-    {
-        *dest++ = pgm_read_byte(src);
+    for(i=0; i<sizeof(hiddenmodes); i++) {
+        if (flags & (1 << i)) *dest++ = pgm_read_byte(hiddenmodes + i);
     }
     // final count
 #ifdef OFFTIM3
-    g_u8mode_cnt = g_u8solid_modes + sizeof(hiddenmodes);
-#endif
-    if (my_reverse_modes) {
-        // TODO: yuck, isn't there a better way to do this?
-        int8_t i;
-        src += g_u8solid_modes;
-        dest = g_u8modes;
-        for(i=0; i<g_u8solid_modes; i++) {
-            src --;
-            *dest = pgm_read_byte(src);
-            dest ++;
-        }
-        if (my_enable_moon) {
-            *dest = 1;
-        }
+    g_u8mode_cnt = dest - g_u8modes;
+    if (my_reverse_modes && (flags & (1 << (sizeof(hiddenmodes)-1)))) {
         g_u8mode_cnt --;  // get rid of last hidden mode, since it's a duplicate turbo
     }
-    if (my_enable_moon) {
-        g_u8mode_cnt ++;
-        g_u8solid_modes ++;
-    }
+#endif
 }
 
 #ifdef ALT_PWM_LVL
@@ -366,34 +429,22 @@ static inline void set_output(uint8_t pwm1) {
 }
 
 void set_level(uint8_t level) {
+#ifdef SOFT_START
+    soft_now = level;
+#endif
     if (level == 0) {
         set_output(0,0);
     } else {
         level -= 1;
-        set_output(pgm_read_byte(ramp_FET  + level),
+        // (only the FET needs compensation; the 7135 is regulated)
+        set_output(vcomp(pgm_read_byte(ramp_FET  + level)),
                    pgm_read_byte(ramp_7135 + level));
     }
 }
 
-void set_mode(uint8_t mode) {
-#ifdef SOFT_START
-    static uint8_t actual_level = 0u;
-    uint8_t target_level = mode;
-    int8_t shift_amount;
-    int8_t diff;
-    do {
-        diff = target_level - actual_level;
-        shift_amount = (diff >> 2) | (diff!=0);
-        actual_level += shift_amount;
-        set_level(actual_level);
-        //_delay_ms(RAMP_SIZE/20);  // slow ramp
-        _delay_ms(RAMP_SIZE/4);  // fast ramp
-    } while (target_level != actual_level);
-#else
+#ifndef SOFT_START
 #define set_mode set_level
-    //set_level(mode);
-#endif  // SOFT_START
-}
+#endif
 
 void blink(uint8_t val, uint16_t speed)
 {
@@ -455,6 +506,38 @@ void toggle(uint8_t *var, uint8_t num) {
     _delay_s();
 }
 
+// Mode group selection phases (kept in noinit RAM between taps)
+#define GS_TAPS  1  // counting taps, to jump straight to group N
+#define GS_BLINK 2  // blinking each group in turn, tap to pick one
+// how long to wait for another tap before giving up on the fast path
+#define GS_TAP_WINDOW 1500
+#ifdef GROUP_PROGRAM_MODE
+// Group programming phases: which slot the ramp is picking a level for
+#define GP_SLOT(n) (0x10 + (n))
+// how long each pass of the programming ramp takes
+#define GP_RAMP_TIME 3000
+#endif
+
+void clear_override() {
+    // leave a one-shot mode without doing a full save_state()
+    g_u8mode_idx = 0;
+    g_u8mode_override = 0;
+    save_mode();
+    eeprom_write_byte((uint8_t *)OPT_mode_override, 0);
+}
+
+void commit_group(uint8_t group) {
+    // the group is written once, after the user has picked it
+    if (group >= NUM_MODEGROUPS) group = NUM_MODEGROUPS - 1;
+    tap_disarm();
+    g_u8modegroup = group;
+    eeprom_write_byte((uint8_t *)OPT_modegroup, group);
+    count_modes();
+    // start at the bottom of the new group
+    g_u8mode_idx = 0;
+    save_mode();
+}
+
 #ifdef TEMPERATURE_MON
 uint8_t get_temp() {
     ADC_on_temperature();
@@ -463,7 +546,7 @@ uint8_t get_temp() {
     uint8_t i;
     get_temperature();
     for(i=0; i<16; i++) {
-        temp += get_voltage();
+        temp += read_adc_8bit();
         _delay_ms(5);
     }
     temp >>= 4;
@@ -471,7 +554,7 @@ uint8_t get_temp() {
 }
 #endif  // TEMPERATURE_MON
 
-#ifdef OFFTIM3
+#if defined(OFFTIM3) && ! defined(OTC_MODEL)
 static inline uint8_t read_otc() {
     // Read and return the off-time cap value
     // Start up ADC for capacitor pin
@@ -497,7 +580,9 @@ static inline uint8_t read_otc() {
 int main(void)
 {
     // check the OTC immediately before it has a chance to charge or discharge
-#ifdef OFFTIM3
+#ifdef OTC_MODEL
+    uint16_t cap_raw = otc_read();  // save it for later
+#elif defined(OFFTIM3)
     uint8_t cap_val = read_otc();  // save it for later
 #endif
 
@@ -516,6 +601,15 @@ int main(void)
 
     // Read config values and saved state
     restore_state();
+#ifdef CHEM_SELECT
+    chem_select(eeprom_read_byte((uint8_t *)OPT_chem));
+#endif
+
+#ifdef OTC_MODEL
+    // how long was the light off?
+    otc_load((uint8_t *)OPT_otc);
+    uint16_t off_ms = otc_ms(cap_raw);
+#endif
 
     // Enable the current mode group
     count_modes();
@@ -528,19 +622,34 @@ int main(void)
     //  so let's not wait until it decays to reset it)
     //if (g_u8fast_presses > 0x20) { g_u8fast_presses = 0; }
 
+    // is this a tap during mode group selection (or programming)?
+    uint8_t group_sel = 0;
+
     // check button press time, unless the mode is overridden
     if (! g_u8mode_override) {
-#ifdef OFFTIM3
+#ifdef OTC_MODEL
+        if (off_ms < OTC_SHORT_MS) {
+#elif defined(OFFTIM3)
         if (cap_val > CAP_SHORT) {
 #else
         if (g_u8fast_presses < 0x20) {
 #endif
-            // Indicates they did a short press, go to the next mode
-            // We don't care what the g_u8fast_presses value is as long as it's over 15
-            g_u8fast_presses = (g_u8fast_presses+1) & 0x1f;
-            next_mode(); // Will handle wrap arounds
+            if (tap_armed()) {
+                // part of a multi-tap sequence, not a mode change
+                group_sel = 1;
+                g_u8fast_presses = 0;
+            } else {
+                // Indicates they did a short press, go to the next mode
+                // We don't care what the g_u8fast_presses value is as long as it's over 15
+                g_u8fast_presses = (g_u8fast_presses+1) & 0x1f;
+                next_mode(); // Will handle wrap arounds
+            }
 #ifdef OFFTIM3
+#ifdef OTC_MODEL
+        } else if (off_ms < OTC_MED_MS) {
+#else
         } else if (cap_val > CAP_MED) {
+#endif
             // User did a medium press, go back one mode
             g_u8fast_presses = 0;
             if (g_u8offtim3) {
@@ -560,7 +669,11 @@ int main(void)
             }
         }
     }
-    save_mode();
+    if (! group_sel) {
+        // anything other than a tap ends the tap sequence
+        tap_disarm();
+        save_mode();
+    }
 
 #ifdef CAP_PIN
     // Charge up the capacitor by setting CAP_PIN to output
@@ -597,7 +710,16 @@ int main(void)
         g_u8fast_presses = 0;
         output = g_u8mode_idx;
     }
+    if (group_sel) {
+        output = GROUP_SELECT_MODE;
+#ifdef GROUP_PROGRAM_MODE
+        if (tap_armed() >= GP_SLOT(0)) output = GROUP_PROGRAM_MODE;
+#endif
+    }
     while(1) {
+#ifdef STACK_CHECK
+        stack_check((uint8_t *)OPT_stack);
+#endif
         if (g_u8fast_presses > 0x0f) {  // Config mode
             _delay_s();       // wait for user to stop fast-pressing button
             g_u8fast_presses = 0; // exit this mode after one use
@@ -635,6 +757,22 @@ int main(void)
             toggle(&g_u8firstboot, 8);
 #endif
 
+#ifdef GROUP_PROGRAM_MODE
+            // Program the levels in the current group?
+            if (g_u8modegroup < NUM_USER_GROUPS) {
+                g_u8mode_idx = GROUP_PROGRAM_MODE;
+                toggle(&g_u8mode_override, 9);
+                g_u8mode_idx = 0;
+            }
+#endif
+
+#ifdef OTC_CAL_MODE
+            // Calibrate the off-time cap?
+            g_u8mode_idx = OTC_CAL_MODE;
+            toggle(&g_u8mode_override, 10);
+            g_u8mode_idx = 0;
+#endif
+
             //output = pgm_read_byte(g_u8modes + g_u8mode_idx);
             output = g_u8modes[g_u8mode_idx];
             actual_level = output;
@@ -726,28 +864,129 @@ int main(void)
         }
 #endif // ifdef BATTCHECK
         else if (output == GROUP_SELECT_MODE) {
-            // exit this mode after one use
-            g_u8mode_idx = 0;
-            g_u8mode_override = 0;
-
-            for(i=0; i<NUM_MODEGROUPS; i++) {
-                g_u8modegroup = i;
-                save_state();
+            // Tap N times to jump to group N, or wait and tap during
+            // the blink for the group you want.  The choice stays in RAM
+            // until then, so this costs a few EEPROM writes instead of
+            // a save_state() per group.
+            uint8_t phase = tap_armed();
+            if (g_u8mode_override) {
+                // just got here from config mode; future taps are
+                // tracked in RAM, so the override isn't needed any more
+                clear_override();
+                tap_arm(GS_TAPS, 0);
+            } else if (phase == GS_TAPS) {
+                tap_arm(GS_TAPS, g_u8tap_val + 1);
+                blink(1, BLINK_SPEED/16);  // acknowledge the tap
+            } else if (phase == GS_BLINK) {  // user tapped during a blink
+                commit_group(g_u8tap_val);
+                blink(2, BLINK_SPEED/16);  // confirm
+            }
 
-                blink(1, BLINK_SPEED/3);
+            if (tap_armed() == GS_TAPS) {
+                // wait a moment for more taps
+                set_level(RAMP_SIZE/8);
+                _delay_ms(GS_TAP_WINDOW);
+                set_level(0);
+                if (g_u8tap_val) {
+                    // tapped N times: group N
+                    commit_group(g_u8tap_val - 1);
+                    blink(2, BLINK_SPEED/16);  // confirm
+                } else {
+                    // no taps, so offer each group in turn
+                    uint8_t group;
+                    _delay_s();
+                    for(group=0; group<NUM_MODEGROUPS; group++) {
+                        tap_arm(GS_BLINK, group);
+                        blink(1, BLINK_SPEED/3);
+                    }
+                    // nothing picked, keep the old group
+                    tap_disarm();
+                    _delay_s();
+                }
             }
-            _delay_s();
-            _delay_s();
+            output = g_u8modes[g_u8mode_idx];
+            actual_level = output;
+        }
+#ifdef GROUP_PROGRAM_MODE
+        else if (output == GROUP_PROGRAM_MODE) {
+            // The light ramps up; tap at the level you want for each mode.
+            // Let it ramp all the way up twice without tapping to finish.
+            uint8_t slot = 0;
+            uint8_t pass, level;
+            if (g_u8mode_override) {
+                // just got here from config mode
+                clear_override();
+                usergroup_begin(g_u8modegroup);
+            } else {
+                // tapped: keep the level the ramp was at
+                slot = tap_armed() - GP_SLOT(0);
+                usergroup_set_level(g_u8modegroup, slot, g_u8tap_val);
+                blink(1, BLINK_SPEED/16);  // acknowledge the tap
+                slot ++;
+            }
+            if (slot < 8) {
+                _delay_ms(BLINK_SPEED);
+                for(pass=0; pass<2; pass++) {
+                    for(level=1; level<=RAMP_SIZE; level++) {
+                        tap_arm(GP_SLOT(slot), level);
+                        set_level(level);
+                        _delay_ms(GP_RAMP_TIME/RAMP_SIZE);
+                    }
+                    set_level(0);
+                    _delay_ms(BLINK_SPEED);
+                }
+            }
+            // no tap (or no room for more), so that's the whole group
+            tap_disarm();
+            usergroup_finish(g_u8modegroup, slot, USERGROUP_HIDDEN);
+            count_modes();
+            blink(2, BLINK_SPEED/16);  // confirm
+            g_u8mode_idx = 0;
+            output = g_u8modes[g_u8mode_idx];
+            actual_level = output;
         }
+#endif  // GROUP_PROGRAM_MODE
+#ifdef OTC_CAL_MODE
+        else if (output == OTC_CAL_MODE) {
+            // One step per power-on, with g_u8mode_override as the step:
+            //   1. (from config mode) blinks once: tap as fast as possible
+            //   2. blinks twice: turn off, count to 3, turn back on
+            //   3. blinks twice if it worked, or buzzes if it didn't
+            uint8_t step = g_u8mode_override;
+            if (step >= 3) {
+                uint8_t ok = otc_fit((uint8_t *)OPT_otc,
+                                     eeprom_read_byte((uint8_t *)OPT_otc),
+                                     otc_log(cap_raw));
+                clear_override();
+                if (ok) blink(2, BLINK_SPEED/16);
+                else blink(32, 500/32);
+                output = g_u8modes[g_u8mode_idx];
+            } else {
+                if (step == 2) {
+                    // the tap; keep it in EEPROM until the next step
+                    // (0xff if it's too close to the top to trust)
+                    eeprom_write_byte((uint8_t *)OPT_otc,
+                        (cap_raw < OTC_CLIPPED) ? otc_log(cap_raw) : 0xff);
+                }
+                g_u8mode_override = step + 1;
+                eeprom_write_byte((uint8_t *)OPT_mode_override, g_u8mode_override);
+                // give the cap time to charge, then say which step is next
+                _delay_s();
+                blink(step, BLINK_SPEED/8);
+                output = RAMP_SIZE/8;
+            }
+            actual_level = output;
+        }
+#endif  // OTC_CAL_MODE
 #ifdef TEMP_CAL_MODE
         else if (output == TEMP_CAL_MODE) {
+            uint8_t result;
             // make sure we don't stay in this mode after button press
-            g_u8mode_idx = 0;
-            g_u8mode_override = 0;
+            clear_override();
 
             // Allow the user to turn off thermal regulation if they want
             g_u8maxtemp = 255;
-            save_state();
+            eeprom_write_byte((uint8_t *)OPT_maxtemp, g_u8maxtemp);
             set_mode(RAMP_SIZE/4);  // start somewhat dim during turn-off-regulation mode
             _delay_s();
             _delay_s();
@@ -755,13 +994,25 @@ int main(void)
             // run at highest output level, to generate heat
             set_mode(RAMP_SIZE);
 
-            // measure, save, wait...  repeat
-            while(1) {
-                g_u8maxtemp = get_temp();
-                save_state();
+            // measure, wait...  until it stops getting hotter
+            // (or until the user turns it off at a comfortable temperature)
+            // (255 means "no limit", so don't save that)
+            thermcal_start(g_u8maxtemp, get_temp());
+            do {
                 _delay_s();
                 _delay_s();
-            }
+                result = thermcal_sample(get_temp(), 254);
+                if (result & THERMCAL_SAVE) {
+                    g_u8maxtemp = thermcal_peak;
+                    eeprom_write_byte((uint8_t *)OPT_maxtemp, g_u8maxtemp);
+                }
+            } while (! (result & THERMCAL_DONE));
+
+            // calibrated; drop back down and regulate as usual from here
+            blink(2, BLINK_SPEED/16);
+            ADC_on();
+            output = RAMP_SIZE/4;
+            actual_level = output;
         }
 #endif  // TEMP_CAL_MODE
         else {  // Regular non-hidden solid mode
@@ -799,7 +1050,12 @@ int main(void)
         g_u8fast_presses = 0;
 #ifdef VOLTAGE_MON
         if (ADCSRA & (1 << ADIF)) {  // if a voltage reading is ready
-            voltage = ADCH;  // get the waiting value
+            // (not ADCH, which only works with a divider)
+            voltage = get_voltage();
+#ifdef VOLTAGE_COMP
+            // new output scale takes effect at the next set_mode()
+            vcomp_update(voltage);
+#endif
             // See if voltage is lower than what we were looking for
             if (voltage < ADC_LOW) {
                 lowbatt_cnt ++;
@@ -816,18 +1072,13 @@ int main(void)
                     actual_level = RAMP_SIZE / 2;
                 } else if (actual_level > 1) {  // regular solid mode
                     // step down from solid g_u8modes somewhat gradually
-                    // drop by 25% each time
-                    actual_level = (actual_level >> 2) + (actual_level >> 1);
-                    // drop by 50% each time
-                    //actual_level = (actual_level >> 1);
+                    // (by the battery profile's step each time)
+                    actual_level = lvp_step(actual_level);
                 } else { // Already at the lowest mode
                     //g_u8mode_idx = 0;  // unnecessary; we never leave this clause
                     //actual_level = 0;  // unnecessary; we never leave this clause
-                    // Turn off the light
-                    set_level(0);
-                    // Power down as many components as possible
-                    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
-                    sleep_mode();
+                    // Turn off the light and power down everything
+                    shutdown();
                 }
                 set_mode(actual_level);
                 output = actual_level;
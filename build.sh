@@ -2,13 +2,14 @@
 
 # Instead of using a Makefile, since most of the firmwares here build in the
 # same exact way, here's a script to do the same thing
+# (set EXTRA_CFLAGS for things like -DBENCH)
 
 export PROGRAM=$1
 export ATTINY=13
 export MCU=attiny$ATTINY
 export CC=avr-gcc
 export OBJCOPY=avr-objcopy
-export CFLAGS="-Wall -g -Os -mmcu=$MCU -c -std=gnu99 -DATTINY=$ATTINY -I.. -I../.. -I../../.."
+export CFLAGS="-Wall -g -Os -mmcu=$MCU -c -std=gnu99 -fstack-usage -DATTINY=$ATTINY -I.. -I../.. -I../../.. $EXTRA_CFLAGS"
 export OFLAGS="-Wall -g -Os -mmcu=$MCU"
 export LDFLAGS=
 export OBJCOPYFLAGS='--set-section-flags=.eeprom=alloc,load --change-section-lma .eeprom=0 --no-change-warnings -O ihex'
@@ -20,7 +21,18 @@ function run () {
   if [ x"$?" != x0 ]; then exit 1 ; fi
 }
 
+# compile the UI transition table, if this firmware has one and uses it
+# (UI_TABLE, in the .c file or in EXTRA_CFLAGS)
+if [ -f UI/$PROGRAM.ui ] && [ -x Scripts/ui_compile.py ]; then
+  if grep -q '^#define UI_TABLE' $PROGRAM.c || [[ " $EXTRA_CFLAGS" == *" -DUI_TABLE"* ]]; then
+    run Scripts/ui_compile.py UI/$PROGRAM.ui $PROGRAM-ui.h
+  fi
+fi
 run $CC $CFLAGS -o $PROGRAM.o -c $PROGRAM.c
 run $CC $OFLAGS $LDFLAGS -o $PROGRAM.elf $PROGRAM.o
 run $OBJCOPY $OBJCOPYFLAGS $PROGRAM.elf $PROGRAM.hex
 run avr-size -C --mcu=$MCU $PROGRAM.elf | grep Full
+# worst-case stack depth vs. free RAM (fails the build if it can overflow)
+if [ -x Scripts/stack_check.py ]; then
+  run Scripts/stack_check.py --mcu $MCU $PROGRAM.elf
+fi
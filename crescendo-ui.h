@@ -0,0 +1,40 @@
+// Generated by Scripts/ui_compile.py from UI/crescendo.ui, edit that instead
+#ifndef UI_COMPILED_H
+#define UI_COMPILED_H
+
+#ifndef RAMP
+Hey, the UI uses RAMP, which is turned off.
+#endif
+#ifndef STEADY
+Hey, the UI uses STEADY, which is turned off.
+#endif
+#ifndef TURBO
+Hey, the UI uses TURBO, which is turned off.
+#endif
+#ifndef BATTCHECK
+Hey, the UI uses BATTCHECK, which is turned off.
+#endif
+
+#define UI_COUNT 8
+#define UI_START 0  // ramp
+#define UI_ACT_ramp_reset 1
+#define UI_ACT_ramp_down 2
+#define UI_ACT_ramp_up 3
+#define UI_FIRST_RAMP 0  // ramp
+#define UI_FIRST_STEADY 1  // steady
+#define UI_FIRST_TURBO 5  // turbo
+#define UI_FIRST_BATTCHECK 7  // battcheck
+
+// mode, then (action << 5) | next state for: tap, timeout, long
+// (next state 31 means stay)
+#define UI_STATE_TABLE \
+    RAMP, 0x01, 0x1f, 0x20,  /*  0 ramp */ \
+    STEADY, 0x05, 0x02, 0x20,  /*  1 steady */ \
+    STEADY, 0x43, 0x1f, 0x20,  /*  2 steady_set */ \
+    RAMP, 0x04, 0x60, 0x20,  /*  3 ramp_tap1 */ \
+    RAMP, 0x05, 0x00, 0x20,  /*  4 ramp_tap2 */ \
+    TURBO, 0x07, 0x06, 0x20,  /*  5 turbo */ \
+    TURBO, 0x01, 0x1f, 0x20,  /*  6 turbo_set */ \
+    BATTCHECK, 0x01, 0x1f, 0x20,  /*  7 battcheck */ \
+
+#endif  // UI_COMPILED_H
@@ -47,6 +47,12 @@
 //#define FET_7135_LAYOUT
 //#define TRIPLEDOWN_LAYOUT
 #define LAYOUT_CONVS3
+//#define LAYOUT_FERRERO_ROCHER  // e-switch instead of a clicky (tk-eswitch.h)
+// attiny25/45/85 + TRIPLEDOWN only: clock Timer1 from the 64 MHz PLL and
+// run the 6x7135 (PB1) and FET (PB4) channels at ultrasonic PWM speeds
+// (default is 64 MHz / 4 / 256 = 62.5 kHz; see tk-attiny.h)
+//#define PLL_PWM
+//#define PWM1_TOP 255        // Timer1 ceiling (fewer PWM steps, faster PWM)
 // Also, assign I/O pins in this file:
 #include "tk-attiny.h"
 
@@ -56,7 +62,22 @@
  */
 
 #define VOLTAGE_MON         // Comment out to disable LVP and battcheck
+// Uncomment to measure the battery without a voltage divider, on drivers
+// where the MCU runs from the cell through a diode (attiny25/45/85 only)
+//#define VOLTAGE_BANDGAP
+//#define VBG_DIODE_DROP 13   // diode drop in 20mV units (13 = 0.26V)
+// Battery type, for LVP and battcheck (profiles are in tk-calibration.h)
+#define CHEMISTRY CHEM_LIION  // or CHEM_LIFEPO4, CHEM_NIMH3
+//#define CHEM_SELECT         // all profiles, chosen by EEPROM byte OPT_chem
 //#define THERMAL_REGULATION  // Comment out to disable thermal regulation
+// Uncomment to use an NTC thermistor on Star 4 instead of the internal
+// sensor (attiny13 has none); generate its table with Scripts/ntc_calc.py
+//#define THERM_NTC
+// Uncomment to calibrate the internal sensor per unit (see tk-tempcal.h):
+// measured at TEMPCAL_AMBIENT on the first boot, so therm_ceil is in real C
+//#define TEMP_CALIBRATION
+//#define TEMPCAL_AMBIENT 21  // room temperature on the first boot, in C
+//#define TEMPCAL_2POINT      // also measure the slope, from a second point
 //#define MAX_THERM_CEIL 70   // Highest allowed temperature ceiling
 //#define DEFAULT_THERM_CEIL 50  // Temperature limit when unconfigured
 
@@ -85,6 +106,11 @@
 #define HALF_SECOND 500
 //#define HALF_SECOND 333
 
+// Fade between levels instead of jumping (mode changes, LVP, thermal)
+//#define SOFT_START
+//#define SOFT_START_TIME 256  // about how long a fade takes, in ms
+//#define SOFT_START_LINEAR     // even steps instead of easing in
+
 // Enable battery indicator mode?
 #ifdef VOLTAGE_MON
 #define USE_BATTCHECK
@@ -94,11 +120,27 @@
 //#define BATTCHECK_8bars  // up to 8 blinks
 #define BATTCHECK_VpT  // Volts + tenths
 
+// Count the charge used, so battcheck can also say how long is left at the
+// last level: hours, then tens of minutes (see tk-fuel.h)
+//#define FUEL_GAUGE
+#ifdef FUEL_GAUGE
+#define FUEL_CH1_MA 2800     // mA at full duty on each channel (8x7135)
+//#define FUEL_CH2_MA 5000
+//#define FUEL_CH3_MA 5000
+#define FUEL_CAPACITY 3000   // mAh
+#endif
+
 // output to use for blinks on battery check (and other g_u8modes)
 #define BLINK_BRIGHTNESS    RAMP_SIZE/4
 // ms per normal-speed blink
 #define BLINK_SPEED         (500/4)
 
+// Levels below ramp level 1, as short full-on pulses with the MCU asleep
+// in between (see tk-firefly.h; moon becomes the dimmest of these)
+// (pulse widths in us, dimmest first; tune so the brightest one is just
+//  below ramp level 1)
+//#define FIREFLY FIREFLY_US(8), FIREFLY_US(16), FIREFLY_US(32), FIREFLY_US(64)
+
 // Uncomment this if you want the ramp to stop when it reaches maximum
 //#define STOP_AT_TOP     HOP_ON_POP
 // Uncomment this if you want it to blink when it reaches maximum
@@ -146,10 +188,51 @@
 
 //#define GOODNIGHT 235         // hour-long ramp down then poweroff
 
+// Run the clicky UI from a transition table instead of the code below
+// (edit UI/crescendo.ui; build.sh compiles it into crescendo-ui.h)
+// (the table has to list every mode which should be reachable)
+//#define UI_TABLE "crescendo-ui.h"
 
-#if defined(MEMTOGGLE) || defined(THERM_CALIBRATION_MODE)
+// Uncomment to trim the clock against the watchdog oscillator on first boot
+// (only as accurate as the watchdog until it's measured in the config
+//  menu's clock calibration, a timed minute; see tk-osccal.h)
+//#define OSC_CALIBRATION
+
+// Uncomment to record the lowest stack headroom seen in EEPROM
+// (see tk-stackcheck.h; costs about 60 bytes)
+//#define STACK_CHECK
+
+
+#if defined(OSC_CALIBRATION) && ! defined(SWITCH_PIN)
+// (a clicky's tap ends the minute; an e-switch press can't, mid-count)
+#define CLOCK_CALIBRATION_MODE 249  // time a minute to measure the watchdog
+#endif
+#if defined(MEMTOGGLE) || defined(THERM_CALIBRATION_MODE) || defined(CLOCK_CALIBRATION_MODE)
 #define CONFIG_MODE
 #endif
+#ifdef UI_TABLE
+// with a UI table, each step of config mode is a UI state too
+#ifdef CONFIG_MODE
+#define CONFIG_MENU 234
+#endif
+#ifdef MEMTOGGLE
+#define MEMTOGGLE_MENU 233
+#endif
+#ifdef THERM_CALIBRATION_MODE
+#define THERMCAL_MENU 232
+#endif
+#ifdef CLOCK_CALIBRATION_MODE
+#define CLOCKCAL_MENU 231
+// which option number it blinks out
+#if defined(MEMTOGGLE) && defined(THERM_CALIBRATION_MODE)
+#define CLOCKCAL_OPTION 3
+#elif defined(MEMTOGGLE) || defined(THERM_CALIBRATION_MODE)
+#define CLOCKCAL_OPTION 2
+#else
+#define CLOCKCAL_OPTION 1
+#endif
+#endif
+#endif
 
 // Calibrate voltage and OTC in this file:
 #include "tk-calibration.h"
@@ -167,24 +250,67 @@
 #include <avr/sleep.h>
 #include <string.h>
 
+#ifdef OSC_CALIBRATION
+#include "tk-osccal.h"
+#endif
+
+#ifdef STACK_CHECK
+#include "tk-stackcheck.h"
+#endif
+
 #define OWN_DELAY           // Don't use stock delay functions.
 #define USE_DELAY_4MS
-#ifdef PARTY_STROBES
-#define USE_DELAY_MS
-#define USE_FINE_DELAY
-#endif
 #define USE_DELAY_S         // Also use _delay_s(), not just _delay_ms()
+#ifdef FUEL_GAUGE
+#define DELAY_HOOK background_tick  // fades and charge counting
+#elif defined(SOFT_START)
+#define DELAY_HOOK soft_tick  // fades move along while we wait
+#endif
 #include "tk-delay.h"
 
+#ifdef FIREFLY
+#define FIREFLY_PULSES FIREFLY
+#include "tk-firefly.h"
+#endif
+
+#ifdef SWITCH_PIN
+#include "tk-eswitch.h"
+#else
+#include "tk-sleep.h"
+#endif
+
+#ifdef PARTY_STROBES
+#include "tk-strobe.h"
+#endif
+
 #ifdef THERMAL_REGULATION
 #define TEMP_10bit
 #endif
 #include "tk-voltage.h"
 
+#ifdef THERM_NTC
+#include "tk-ntc.h"
+#endif
+
+#ifdef THERMAL_REGULATION
+// median, lowpass, and least-squares trend on the temperature readings
+// (trend over the last 64 readings)
+#define SENSE_SIZE 8
+#define SENSE_IIR 3
+#define SENSE_DECIMATE 8
+#include "tk-sense.h"
+#endif
+
 #ifdef RANDOM_STROBE
 #include "tk-random.h"
 #endif
 
+#ifdef THERM_CALIBRATION_MODE
+// one sample per loop (~0.5s), so wait longer for it to level off
+#define THERMCAL_SETTLE 96
+#include "tk-thermcal.h"
+#endif
+
 /*
  * global variables
  */
@@ -208,9 +334,63 @@ uint8_t g_u8long_press __attribute__ ((section (".noinit")));
 uint8_t g_u8mode_idx __attribute__ ((section (".noinit")));
 uint8_t g_u8ramp_level __attribute__ ((section (".noinit")));
 int8_t  g_i8ramp_dir __attribute__ ((section (".noinit")));
+#ifndef UI_TABLE
 uint8_t g_u8next_mode_num __attribute__ ((section (".noinit")));
+#endif
 uint8_t target_level;  // ramp level before thermal stepdown
 uint8_t actual_level;  // last ramp level activated
+uint8_t first_loop = 1;  // first time through the main loop since power-on
+#ifdef BENCH
+// lets Scripts/bench.py see where each main loop iteration starts
+volatile uint8_t bench_loops;
+#define BENCH_LOOP() bench_loops++
+#else
+#define BENCH_LOOP()
+#endif
+
+#ifdef SOFT_START
+#define soft_now actual_level
+#include "tk-softstart.h"
+#endif
+
+#ifdef FUEL_GAUGE
+#ifndef BATTCHECK
+Hey, FUEL_GAUGE needs VOLTAGE_MON, for battcheck and the resting voltage.
+#endif
+#include "tk-fuel.h"
+#ifdef PARTY_STROBES
+// tk-strobe.h flashes one channel all the way on
+#ifdef FET_PWM_LVL
+#ifndef FUEL_CH3_MA
+Hey, FUEL_GAUGE needs FUEL_CH3_MA, since the party strobes flash the FET.
+#endif
+#define FUEL_STROBE_MA FUEL_CH3_MA
+#else
+#define FUEL_STROBE_MA FUEL_CH1_MA
+#endif
+#endif
+#ifdef FIREFLY
+// average of one pulse (3 cycles per count) every 16ms, in 1/1024 mA
+#define FIREFLY_UA(width) ((uint16_t)((uint32_t)(width) * FUEL_CH1_MA * (192000 / (F_CPU/1000)) / 1000))
+#endif
+void background_tick(uint8_t ms) {
+#ifdef SOFT_START
+    soft_tick(ms);
+#endif
+    fuel_tick(ms);
+}
+#endif
+
+#ifdef UI_TABLE
+#define ui_state g_u8mode_idx
+#include "tk-ui.h"
+#if defined(CONFIG_MODE) && ! defined(UI_FIRST_CONFIG_MENU)
+Hey, config mode needs its states in UI/crescendo.ui too.
+#endif
+// where LVP and thermal calibration go when they give up on a mode
+#define STEADY_IDX UI_FIRST_STEADY
+#else
+#define STEADY_IDX 1
 
 uint8_t g_u8modes[] = {
     RAMP, STEADY, TURBO,
@@ -257,6 +437,7 @@ uint8_t g_u8modes[] = {
     SOS,
 #endif
 };
+#endif  // ifdef UI_TABLE
 
 // Modes (gets set when the light starts up based on saved config values)
 PROGMEM const uint8_t ramp_ch1[]  = { RAMP_CH1 };
@@ -266,13 +447,22 @@ PROGMEM const uint8_t ramp_ch2[] = { RAMP_CH2 };
 #ifdef RAMP_CH3
 PROGMEM const uint8_t ramp_ch3[] = { RAMP_CH3 };
 #endif
+#ifdef FIREFLY
+#define RAMP_SIZE  (FIREFLY_LEVELS + sizeof(ramp_ch1))
+#else
 #define RAMP_SIZE  sizeof(ramp_ch1)
+#endif
 
 void _delay_500ms() {
+#ifdef FIREFLY
+    // sleep through it, if the light is in firefly
+    firefly_sleep(HALF_SECOND/16);
+#else
     _delay_4ms(HALF_SECOND/4);
+#endif
 }
 
-#if defined(MEMORY) || defined(CONFIG_MODE)
+#if defined(MEMORY) || defined(CONFIG_MODE) || defined(OSC_CALIBRATION) || defined(STACK_CHECK) || defined(VOLTAGE_BANDGAP) || defined(CHEM_SELECT) || defined(TEMP_CALIBRATION) || defined(FUEL_GAUGE)
 #if (ATTINY == 85) || (ATTINY == 45)
 #define EEP_WEAR_LVL_LEN 128
 #elif (ATTINY == 25)
@@ -317,7 +507,9 @@ void save_state() {
 
 #ifdef CONFIG_MODE
 void restore_state() {
+#if defined(MEMTOGGLE) || defined(THERM_CALIBRATION_MODE) || defined(MEMORY)
     uint8_t eep;
+#endif
 #ifdef MEMTOGGLE
     // g_u8memory is either 1 or 0
     // (if it's unconfigured, 0xFF, assume it's off)
@@ -333,7 +525,7 @@ void restore_state() {
 #ifdef THERM_CALIBRATION_MODE
     // load therm_ceil
     eep = eeprom_read_byte((uint8_t *)OPT_therm_ceil);
-    if ((eep > 0) && (eep < MAX_THERM_CEIL)) {
+    if ((eep > 0) && (eep <= MAX_THERM_CEIL)) {
         therm_ceil = eep;
     }
 #endif
@@ -355,6 +547,16 @@ void restore_state() {
 }
 #endif  // ifdef CONFIG_MODE
 
+#ifdef UI_TABLE
+void ui_action(uint8_t action) {
+    if (action == UI_ACT_ramp_reset) {
+        g_u8ramp_level = 1;
+        g_i8ramp_dir = 1;
+    }
+    else if (action == UI_ACT_ramp_down) g_i8ramp_dir = -1;
+    else if (action == UI_ACT_ramp_up) g_i8ramp_dir = 1;
+}
+#else
 static inline void next_mode() {
     // allow an override, if it exists
     //if (next_mode_num < sizeof(g_u8modes)) {
@@ -371,6 +573,20 @@ static inline void next_mode() {
         g_u8mode_idx = 1;
     }
 }
+#endif  // ifdef UI_TABLE
+
+#if defined(PLL_PWM) && (PWM1_TOP != 255)
+// Ramps are calculated for 0-255, so squeeze them into Timer1's range,
+// without letting the lowest levels round down to nothing.
+// (or generate ramps with level_calc.py using pwm_max = PWM1_TOP instead)
+static inline uint8_t pwm1_scale(uint8_t pwm) {
+    uint8_t scaled = ((uint16_t)pwm * (PWM1_TOP+1)) >> 8;
+    if (pwm && (! scaled)) scaled = 1;
+    return scaled;
+}
+#else
+#define pwm1_scale(pwm) (pwm)
+#endif
 
 #ifdef RAMP_CH3
 static inline void set_output(uint8_t pwm1, uint8_t pwm2, uint8_t pwm3) {
@@ -381,17 +597,41 @@ static inline void set_output(uint8_t pwm1, uint8_t pwm2) {
 static inline void set_output(uint8_t pwm1) {
 #endif
 #endif
+#ifdef PLL_PWM
+    PWM_LVL = pwm1_scale(pwm1);  // Timer1, OC1A
+#else
     PWM_LVL = pwm1;
+#endif
 #ifdef RAMP_CH2
     ALT_PWM_LVL = pwm2;
 #endif
 #ifdef RAMP_CH3
-    FET_PWM_LVL = pwm3;
+    FET_PWM_LVL = pwm1_scale(pwm3);
+#endif
+#ifdef FUEL_GAUGE
+    fuel_ma = FUEL_MA(pwm1, FUEL_CH1_MA)
+#ifdef RAMP_CH2
+            + FUEL_MA(pwm2, FUEL_CH2_MA)
+#endif
+#ifdef RAMP_CH3
+            + FUEL_MA(pwm3, FUEL_CH3_MA)
+#endif
+            ;
 #endif
 }
 
 void set_level(uint8_t level) {
     actual_level = level;
+#ifdef FIREFLY
+    // the lowest few levels are firefly, with the PWM outputs off
+    uint8_t firefly = 0;
+    firefly_off();
+    if (level > FIREFLY_LEVELS) level -= FIREFLY_LEVELS;
+    else {
+        firefly = level;
+        level = 0;
+    }
+#endif
     TCCR0A = PHASE;
     if (level == 0) {
 #ifdef RAMP_CH3
@@ -424,9 +664,37 @@ void set_level(uint8_t level) {
 #endif
 #endif
     }
+#ifdef FIREFLY
+    if (firefly) firefly_on(firefly);
+#ifdef FUEL_GAUGE
+    fuel_ua = FIREFLY_UA(firefly_width);
+#endif
+#endif
 }
 
+#ifndef SOFT_START
 #define set_mode set_level
+#endif
+
+#ifdef FUEL_GAUGE
+uint16_t level_ma(uint8_t level) {
+    // what set_level(level) would draw, without setting it
+#ifdef FIREFLY
+    if (level <= FIREFLY_LEVELS) return 0;  // close enough
+    level -= FIREFLY_LEVELS;
+#endif
+    if (level == 0) return 0;
+    level --;
+    return FUEL_MA(pgm_read_byte(ramp_ch1 + level), FUEL_CH1_MA)
+#ifdef RAMP_CH2
+         + FUEL_MA(pgm_read_byte(ramp_ch2 + level), FUEL_CH2_MA)
+#endif
+#ifdef RAMP_CH3
+         + FUEL_MA(pgm_read_byte(ramp_ch3 + level), FUEL_CH3_MA)
+#endif
+         ;
+}
+#endif
 
 void blink(uint8_t val, uint8_t speed)
 {
@@ -457,22 +725,33 @@ static inline void strobe(uint8_t ontime, uint8_t offtime) {
 #endif
 
 #ifdef PARTY_STROBES
-static inline void party_strobe(uint8_t ontime, uint8_t offtime) {
-    set_level(RAMP_SIZE);
-    if (ontime) {
-        _delay_ms(ontime);
-    } else {
-        _delay_zero();
-    }
-    set_level(0);
-    _delay_ms(offtime);
+// Timing is done by tk-strobe.h in the background; times are in timer ticks
+// Shortest flash, used for the faster strobes
+#define PARTY_ONTIME STROBE_US(200)
+
+#ifdef FUEL_GAUGE
+void strobe_fuel(uint16_t ontime, uint16_t period, uint8_t flashes) {
+    // the flashes don't pass through _delay_*(), so count them here
+    fuel_ma = (uint32_t)FUEL_STROBE_MA * ontime / period;
+    fuel_ticks((uint32_t)period * flashes / STROBE_TICKS_PER_MS);
 }
+#else
+#define strobe_fuel(ontime, period, flashes)
+#endif
 
-void party_strobe_loop(uint8_t ontime, uint8_t offtime) {
-    uint8_t i;
-    for(i=0; i<32; i++) {
-        party_strobe(ontime, offtime);
-    }
+static inline void party_strobe(uint16_t ontime, uint16_t offtime) {
+    strobe_set(ontime, offtime);
+    strobe_start();
+    strobe_wait(1);
+    strobe_fuel(ontime, ontime + offtime, 1);
+}
+
+void party_strobe_loop(uint16_t ontime, uint16_t period) {
+    strobe_set(ontime, period - ontime);
+    strobe_start();
+    // come back to the main loop once in a while, for LVP
+    strobe_wait(32);
+    strobe_fuel(ontime, period, 32);
 }
 #endif
 
@@ -496,20 +775,20 @@ static inline void biking_mode(uint8_t lo, uint8_t hi) {
     uint8_t i;
     for(i=0; i<4; i++) {
         //set_output(255,0);
-        set_mode(hi);
+        set_level(hi);
         _delay_4ms(2);
         //set_output(0,255);
-        set_mode(lo);
+        set_level(lo);
         _delay_4ms(15);
     }
     //_delay_ms(720);
     _delay_s();
 #else  // smaller bike mode
     // small/minimal version
-    set_mode(hi);
+    set_level(hi);
     //set_output(255,0);
     _delay_4ms(4);
-    set_mode(lo);
+    set_level(lo);
     //set_output(0,255);
     _delay_s();
 #endif  // ifdef FULL_BIKING_MODE
@@ -517,8 +796,12 @@ static inline void biking_mode(uint8_t lo, uint8_t hi) {
 #endif
 
 #ifdef THERMAL_REGULATION
+#ifdef THERM_NTC
+#define current_temperature ntc_temperature
+#else
 #define TEMP_ORIGIN 275  // roughly 0 C or 32 F (ish)
-int16_t current_temperature() {
+// average of a few readings, in 12.3 fixed-point
+uint16_t temperature_raw() {
     ADC_on_temperature();
     // average a few values; temperature is noisy
     // (use some of the noise as extra precision, ish)
@@ -529,11 +812,24 @@ int16_t current_temperature() {
         temp += get_temperature();
         _delay_4ms(1);
     }
+    return temp;
+}
+
+#ifdef TEMP_CALIBRATION
+#define TEMPCAL_READ() (temperature_raw() >> 3)
+#include "tk-tempcal.h"
+#endif
+
+int16_t current_temperature() {
     // convert 12.3 fixed-point to 13.2 fixed-point
     // ... and center it at 0 C
-    temp = (temp>>1) - (TEMP_ORIGIN<<2);
-    return temp;
+#ifdef TEMP_CALIBRATION
+    return tempcal_celsius(temperature_raw() >> 1);
+#else
+    return (temperature_raw() >> 1) - (TEMP_ORIGIN<<2);
+#endif
 }
+#endif  // ifdef THERM_NTC
 #endif  // ifdef THERMAL_REGULATION
 
 #ifdef GOODNIGHT
@@ -541,12 +837,13 @@ void poweroff() {
 #else
 static inline void poweroff() {
 #endif
-    // Turn off main LED
-    set_level(0);
-    // Power down as many components as possible
-    ADCSRA &= ~(1<<7); //ADC off
-    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
-    sleep_mode();
+#ifdef SWITCH_PIN
+    // standby until the next press
+    eswitch_off();
+#else
+    // Turn off the light and power down everything
+    shutdown();
+#endif
 }
 
 #ifdef CONFIG_MODE
@@ -572,18 +869,505 @@ void toggle(uint8_t *var, uint8_t num) {
 /* Set pins as input high (considering they are all floating
  * Careful with Convoy "red" driver, MOSI is grounded */
 void init_unused_pins() {
+    uint8_t pins = 0;
+#ifdef STAR2_PIN
+    pins |= (1 << STAR2_PIN);
+#endif
+#ifdef STAR3_PIN
+    pins |= (1 << STAR3_PIN);
+#endif
+#ifdef STAR4_PIN
+    pins |= (1 << STAR4_PIN);
+#endif
+#ifdef SWITCH_PIN
+    pins |= (1 << SWITCH_PIN);
+#endif
+#ifdef VOLTAGE_BANDGAP
+    pins |= (1 << VOLTAGE_PIN);  // no divider there now
+#endif
+    // but not the ones we use for PWM or analog inputs
+#ifdef THERM_NTC
+    pins &= ~(1 << NTC_PIN);  // a pull-up would skew the divider
+#endif
+#ifdef RAMP_CH2
+    pins &= ~(1 << ALT_PWM_PIN);
+#endif
+#ifdef RAMP_CH3
+    pins &= ~(1 << FET_PWM_PIN);
+#endif
+    PORTB = pins;
+#ifdef RED_PIN
+    // indicator LEDs aren't used, so hold them off
+    DDRB |= (1 << RED_PIN) | (1 << GREEN_PIN);
+#endif
+}
+
+/*
+ * Modes
+ */
+
+// smooth ramp mode, lets user select any output level
+static void ramp_mode() {
+    set_mode(g_u8ramp_level);  // turn light on
+
+#ifndef UI_TABLE
+    // ramp up by default
+    //if (g_u8fast_presses == 0) {
+    //    ramp_dir = 1;
+    //}
+    // double-tap to ramp down
+    //else if (g_u8fast_presses == 1) {
+    if (g_u8fast_presses == 1) {
+        g_u8next_mode_num = g_u8mode_idx;  // stay in ramping mode
+        g_i8ramp_dir = -1;             // ... but go down
+    }
+    // triple-tap to enter turbo
+    else if (g_u8fast_presses == 2) {
+        g_u8next_mode_num = g_u8mode_idx + 2;  // bypass "steady" mode
+    }
+#endif
+
+    // wait a bit before actually ramping
+    // (give the user a chance to select moon, or double-tap)
+    _delay_500ms();
+
+#ifdef UI_TABLE
+    ui_event(UI_TIMEOUT);
+#else
+    // if we got through the delay, assume normal operation
+    // (not trying to double-tap or triple-tap)
+    // (next mode should be normal)
+    g_u8next_mode_num = 255;
+    // ramp up on single tap
+    // (cancel earlier reversal)
+    if (g_u8fast_presses == 1) {
+        g_i8ramp_dir = 1;
+    }
+#endif
+    // don't want this confusing us any more
+    g_u8fast_presses = 0;
+
+    // Just in case (SRAM could have partially decayed)
+#ifdef RAM_DECAY_PROBLEM
+    g_i8ramp_dir = (g_i8ramp_dir == 1) ? 1 : -1;
+#endif /* RAM_DECAY_PROBLEM */
+    // Do the actual ramp
+    for (;; g_u8ramp_level += g_i8ramp_dir) {
+        set_level(g_u8ramp_level);
+        _delay_4ms(RAMP_TIME/RAMP_SIZE/4);
+        if (
+            ((g_i8ramp_dir > 0) && (g_u8ramp_level >= RAMP_SIZE))
+            ||
+            ((g_i8ramp_dir < 0) && (g_u8ramp_level <= 1))
+        )
+            break;
+    }
+    if (g_i8ramp_dir == 1) {
+#ifdef STOP_AT_TOP
+        // go to steady mode
+        g_u8mode_idx = STEADY_IDX;
+#endif
+#ifdef BLINK_AT_TOP
+        // blink at the top
+        set_level(0);
+        _delay_4ms(2);
+#endif
+    }
+    g_i8ramp_dir = -g_i8ramp_dir;
+}
 
-#if defined(STAR2_PIN) && defined(STAR3_PIN) && defined(STAR4_PIN)
-  PORTB = (1 << STAR2_PIN) | (1 << STAR3_PIN) | (1 << STAR4_PIN);
+static void steady_mode() {
+    // normal flashlight mode
+    if (first_loop) {
+        set_mode(g_u8ramp_level);
+        target_level = g_u8ramp_level;
+    }
+    // User has 0.5s to tap again to advance to the next mode
+    //next_mode_num = 255;
+    _delay_500ms();
+    // After a delay, assume user wants to adjust ramp
+    // instead of going to next mode (unless they're
+    // tapping rapidly, in which case we should advance to turbo)
+#ifdef UI_TABLE
+    ui_event(UI_TIMEOUT);
+#else
+    g_u8next_mode_num = 0;
+#endif
+}
+
+static void turbo_mode() {
+    // turbo is special because it's easier to handle that way
+    if (first_loop) {
+        set_mode(RAMP_SIZE);
+        target_level = RAMP_SIZE;
+    }
+    //next_mode_num = 255;
+    _delay_500ms();
+    // go back to the previously-memorized level
+    // if the user taps after a delay,
+    // instead of advancing to blinkies
+    // (allows something similar to "momentary" turbo)
+#ifdef UI_TABLE
+    ui_event(UI_TIMEOUT);
 #else
-#  error Please adapt unused pin init
-#endif /* STAR2_PIN | STAR3_PIN | STAR4_PIN */
+    g_u8next_mode_num = 1;
+#endif
+}
+
+#ifdef STROBE
+static void strobe_mode() {
+    // 10Hz tactical strobe
+    strobe(33/4,67/4);
+}
+#endif // ifdef STROBE
+
+#ifdef POLICE_STROBE
+static void police_strobe_mode() {
+    // police-like strobe
+    strobe(20/4,40/4);
+    strobe(40/4,80/4);
+}
+#endif // ifdef POLICE_STROBE
+
+#ifdef RANDOM_STROBE
+static void random_strobe_mode() {
+    // pseudo-random strobe
+    uint8_t ms = (34 + (pgm_rand() & 0x3f))>>2;
+    //strobe(ms, ms);
+    set_level(RAMP_SIZE);
+    _delay_4ms(ms);
+    set_level(0);
+    _delay_4ms(ms);
+    //strobe(ms, ms);
 }
+#endif // ifdef RANDOM_STROBE
+
+#ifdef BIKING_MODE
+static void biking_mode_hi() {
+    // 2-level stutter beacon for biking and such
+    biking_mode(RAMP_SIZE/2, RAMP_SIZE);
+}
+#endif  // ifdef BIKING_MODE
+
+#ifdef BIKING_MODE2
+static void biking_mode_lo() {
+    // 2-level stutter beacon for biking and such
+    biking_mode(RAMP_SIZE/4, RAMP_SIZE/2);
+}
+#endif  // ifdef BIKING_MODE
+
+#ifdef HEART_BEACON
+static void heart_beacon_mode() {
+    set_level(RAMP_SIZE);
+    _delay_4ms(1);
+    set_level(0);
+    _delay_4ms(250/4);
+    set_level(RAMP_SIZE);
+    _delay_4ms(1);
+    set_level(0);
+    _delay_4ms(750/4);
+}
+#endif
+
+#ifdef PARTY_STROBE12
+static void party_strobe12_mode() {
+    party_strobe_loop(STROBE_MS(1), STROBE_HZ(12));
+}
+#endif
+
+#ifdef PARTY_STROBE24
+static void party_strobe24_mode() {
+    party_strobe_loop(PARTY_ONTIME, STROBE_HZ(24));
+}
+#endif
+
+#ifdef PARTY_STROBE60
+static void party_strobe60_mode() {
+    party_strobe_loop(PARTY_ONTIME, STROBE_HZ(60));
+}
+#endif
+
+#ifdef PARTY_VARSTROBE1
+static void party_varstrobe1_mode() {
+    uint8_t j, speed;
+    for(j=0; j<66; j++) {
+        if (j<33) {
+            speed = j;
+        }
+        else {
+            speed = 66-j;
+        }
+        // 1ms flash, 54ms to 120ms dark
+        party_strobe(STROBE_MS(1),
+                     (uint16_t)((speed+33-6)<<1) * STROBE_TICKS_PER_MS);
+    }
+}
+#endif
+
+#ifdef PARTY_VARSTROBE2
+static void party_varstrobe2_mode() {
+    uint8_t j, speed;
+    for(j=0; j<100; j++) {
+        if (j<50) {
+            speed = j;
+        }
+        else {
+            speed = 100-j;
+        }
+        // short flash, 9ms to 59ms dark
+        party_strobe(PARTY_ONTIME,
+                     (uint16_t)(speed+9) * STROBE_TICKS_PER_MS);
+    }
+}
+#endif
+
+#ifdef BATTCHECK
+// battery check mode, show how much power is left
+static void battcheck_mode() {
+    _delay_500ms();
+#ifdef BATTCHECK_VpT
+    // blink out volts and tenths
+    uint8_t result = battcheck();
+    blink(result >> 5, BLINK_SPEED/5);
+    _delay_4ms(BLINK_SPEED*2/3);
+    blink(1,8/4);
+    _delay_4ms(BLINK_SPEED*4/3);
+    blink(result & 0b00011111, BLINK_SPEED/5);
+#else  // ifdef BATTCHECK_VpT
+    // blink zero to five times to show voltage
+    // (or zero to nine times, if 8-bar mode)
+    // (~0%, ~25%, ~50%, ~75%, ~100%, >100%)
+    blink(battcheck(), BLINK_SPEED/4);
+#endif  // ifdef BATTCHECK_VpT
+#ifdef FUEL_GAUGE
+    // then time left at the last level: hours, then tens of minutes
+    // (9 and 5 means "that or more")
+    uint16_t minutes = fuel_minutes(level_ma(g_u8ramp_level));
+    if (minutes > 9*60 + 59) minutes = 9*60 + 59;
+    _delay_s();
+    blink(minutes / 60, BLINK_SPEED/5);
+    _delay_4ms(BLINK_SPEED*2/3);
+    blink(1,8/4);
+    _delay_4ms(BLINK_SPEED*4/3);
+    blink((minutes % 60) / 10, BLINK_SPEED/5);
+#endif
+    // wait between readouts
+    _delay_s();
+    _delay_s();
+}
+
+#ifdef CLOCK_CALIBRATION_MODE
+static void clockcal_mode() {
+    // Start a stopwatch at the blink, and tap at exactly one minute.
+    // The next boot saves the count (see main()).
+    set_mode(RAMP_SIZE/4);
+    _delay_s();
+    blink(1, BLINK_SPEED/4);
+    set_level(RAMP_SIZE/4);
+    osccal_count();
+    // no tap in two minutes, so give up
+    blink(32, 500/32/4);
+    g_u8mode_idx = STEADY_IDX;
+}
+#endif
+#endif // ifdef BATTCHECK
+
+#ifdef GOODNIGHT
+// "good night" mode, slowly ramps down and shuts off
+static void goodnight_mode() {
+    uint8_t i, j;
+    // signal that this is *not* the STEADY mode
+    blink(2, BLINK_SPEED/16);
+#define GOODNIGHT_TOP (RAMP_SIZE/6)
+    // ramp up instead of going directly to the top level
+    // (probably pointless in this UI)
+    /*
+    for (i=1; i<=GOODNIGHT_TOP; i++) {
+        set_mode(i);
+        _delay_4ms(2*RAMP_TIME/RAMP_SIZE/4);
+    }
+    */
+    // ramp down over about an hour
+    for(i=GOODNIGHT_TOP; i>=1; i--) {
+        set_mode(i);
+        // how long the down ramp should last, in seconds
+#define GOODNIGHT_TIME 60*60
+        // how long does _delay_s() actually last, in seconds?
+        // (the loop around each 4ms and DELAY_HOOK add some cycles to
+        //  every 4ms, about 1%, whether or not the clock is trimmed)
+#define DELAY_OVERHEAD 1.01
+#ifdef OSC_CALIBRATION
+// the clock is trimmed to this unit's measured watchdog (see tk-osccal.h)
+#define ONE_SECOND (1.0 * DELAY_OVERHEAD)
+#else
+// clock error and overhead together (calibrate this per driver, probably)
+#define ONE_SECOND 1.03
+#endif
+#define GOODNIGHT_STEPS (1+GOODNIGHT_TOP)
+#define GOODNIGHT_LOOPS (uint8_t)((GOODNIGHT_TIME) / ((2*ONE_SECOND) * GOODNIGHT_STEPS))
+        // NUM_LOOPS = (60*60) / ((2*ONE_SECOND) * (1+MODE_LOW-MODE_MOON))
+        // (where ONE_SECOND is how many seconds _delay_s() actually lasts)
+        // (in my case it's about 0.89)
+        for(j=0; j<GOODNIGHT_LOOPS; j++) {
+            _delay_s();
+            _delay_s();
+            //_delay_ms(10);
+        }
+    }
+    poweroff();
+}
+#endif // ifdef GOODNIGHT
+
+/*
+ * Mode registry, indexed by 255-mode, so finding a mode is one lookup
+ * instead of a long chain of comparisons.  To add a mode, give it an ID
+ * above, write its function, and add a line here.  (and add it to
+ * g_u8modes[] or UI/crescendo.ui, so it can be reached)
+ * Modes with no function here, like THERM_CALIBRATION_MODE, are handled
+ * elsewhere in the main loop and only need their flags.
+ * Scripts/stack_check.py reads this table to count every mode's stack
+ * use, so keep its name and layout in step with CALL_TABLES there.
+ */
+#define MODE_THERMAL  1  // thermal regulation adjusts the output
+#define MODE_LVP_STEP 2  // LVP steps the level down in place
+                         // (instead of dropping to steady at 1/4 power)
+
+typedef struct {
+    void (*run)();
+    uint8_t flags;
+} mode_info;
+
+PROGMEM const mode_info mode_registry[] = {
+    [255-TURBO]  = { turbo_mode, MODE_THERMAL },
+    [255-RAMP]   = { ramp_mode, 0 },
+    [255-STEADY] = { steady_mode, MODE_THERMAL | MODE_LVP_STEP },
+#ifdef BATTCHECK
+    [255-BATTCHECK] = { battcheck_mode, 0 },
+#endif
+#ifdef THERM_CALIBRATION_MODE
+    [255-THERM_CALIBRATION_MODE] = { 0, MODE_THERMAL },
+#endif
+#ifdef CLOCK_CALIBRATION_MODE
+    [255-CLOCK_CALIBRATION_MODE] = { clockcal_mode, 0 },
+#endif
+#ifdef BIKING_MODE
+    [255-BIKING_MODE] = { biking_mode_hi, 0 },
+#endif
+#ifdef BIKING_MODE2
+    [255-BIKING_MODE2] = { biking_mode_lo, 0 },
+#endif
+#ifdef STROBE
+    [255-STROBE] = { strobe_mode, 0 },
+#endif
+#ifdef POLICE_STROBE
+    [255-POLICE_STROBE] = { police_strobe_mode, 0 },
+#endif
+#ifdef RANDOM_STROBE
+    [255-RANDOM_STROBE] = { random_strobe_mode, 0 },
+#endif
+#ifdef SOS
+    [255-SOS] = { SOS_mode, 0 },
+#endif
+#ifdef HEART_BEACON
+    [255-HEART_BEACON] = { heart_beacon_mode, 0 },
+#endif
+#ifdef PARTY_STROBE12
+    [255-PARTY_STROBE12] = { party_strobe12_mode, 0 },
+#endif
+#ifdef PARTY_STROBE24
+    [255-PARTY_STROBE24] = { party_strobe24_mode, 0 },
+#endif
+#ifdef PARTY_STROBE60
+    [255-PARTY_STROBE60] = { party_strobe60_mode, 0 },
+#endif
+#ifdef PARTY_VARSTROBE1
+    [255-PARTY_VARSTROBE1] = { party_varstrobe1_mode, 0 },
+#endif
+#ifdef PARTY_VARSTROBE2
+    [255-PARTY_VARSTROBE2] = { party_varstrobe2_mode, 0 },
+#endif
+#ifdef GOODNIGHT
+    [255-GOODNIGHT] = { goodnight_mode, 0 },
+#endif
+};
+#define MODE_COUNT (sizeof(mode_registry) / sizeof(mode_info))
+
+static inline uint8_t mode_flags(uint8_t mode) {
+    uint8_t i = 255 - mode;
+    if (i >= MODE_COUNT) return 0;
+    return pgm_read_byte(&mode_registry[i].flags);
+}
+
+static inline void run_mode(uint8_t mode) {
+    uint8_t i = 255 - mode;
+    void (*run)();
+    if (i >= MODE_COUNT) return;  // shouldn't happen
+    run = (void (*)())pgm_read_word(&mode_registry[i].run);
+    if (run) run();
+}
+
+#ifdef OSC_CALIBRATION
+#define OPT_osccal (EEP_WEAR_LVL_LEN+3)
+#define OPT_wdtcal (EEP_WEAR_LVL_LEN+12)  // 2 bytes, watchdog periods per minute
+#endif
+#ifdef STACK_CHECK
+#define OPT_stack (EEP_WEAR_LVL_LEN+4)
+#endif
+#ifdef VOLTAGE_BANDGAP
+#define OPT_vbg (EEP_WEAR_LVL_LEN+5)  // this unit's bandgap, mV - 1000
+#endif
+#ifdef CHEM_SELECT
+#define OPT_chem (EEP_WEAR_LVL_LEN+6)  // CHEM_LIION, CHEM_LIFEPO4...
+#endif
+#ifdef TEMP_CALIBRATION
+#define OPT_tempcal (EEP_WEAR_LVL_LEN+7)  // 3 bytes, see tk-tempcal.h
+#endif
+#ifdef FUEL_GAUGE
+#define OPT_fuel (EEP_WEAR_LVL_LEN+10)  // 2 bytes, mAh left
+#endif
 
 int main(void)
 {
+#ifdef OSC_CALIBRATION
+    // Use this unit's saved clock trim, or measure it on the first boot
+    // (erase the EEPROM to force a new measurement)
+    // A tap which ended CLOCK_CALIBRATION_MODE's minute saves how many
+    // watchdog periods that was, and trims again to match.
+    uint16_t clockcal = osccal_counted();
+    {
+        uint8_t cal = eeprom_read_byte((uint8_t *)OPT_osccal);
+        if ((clockcal != 0xffff) && clockcal) {
+            eeprom_write_word((uint16_t *)OPT_wdtcal, clockcal);
+            cal = 0xff;
+        }
+        if (cal == 0xff) {
+            cal = osccal_calibrate(osccal_target(eeprom_read_word((uint16_t *)OPT_wdtcal)));
+            eeprom_write_byte((uint8_t *)OPT_osccal, cal);
+        } else {
+            OSCCAL = cal;
+        }
+    }
+#endif
+
+#ifdef VOLTAGE_BANDGAP
+    vbg_calibrate(eeprom_read_byte((uint8_t *)OPT_vbg));
+#endif
+#ifdef CHEM_SELECT
+    chem_select(eeprom_read_byte((uint8_t *)OPT_chem));
+#endif
+#if defined(THERMAL_REGULATION) && defined(TEMP_CALIBRATION) && ! defined(THERM_NTC)
+    // measures this chip's sensor offset on the first boot
+    tempcal_init((uint8_t *)OPT_tempcal);
+#endif
+
     init_unused_pins();
 
+#ifdef SWITCH_PIN
+    // A press from standby is like clicking a clicky switch on
+    // (a tap resets with RAM intact, just like a clicky tap)
+    if (eswitch_init()) g_u8long_press = 1;
+#endif
+
     // Set PWM pin to output
     DDRB |= (1 << PWM_PIN);     // enable main channel
 #ifdef RAMP_CH2
@@ -602,10 +1386,30 @@ int main(void)
     TCCR0B = 0x01; // pre-scaler for timer (1 => 1, 2 => 8, 3 => 64...)
 
 #ifdef RAMP_CH3
+#ifdef PLL_PWM
+    // Start the PLL, wait for it to lock, then clock Timer1 from it
+    PLLCSR = _BV (PLLE);
+    _delay_4ms(1);  // datasheet says wait 100us before checking the lock
+    while (! (PLLCSR & _BV (PLOCK))) {}
+    PLLCSR |= _BV (PCKE);
+    // PWM on both OC1A (PB1) and OC1B (PB4), same ceiling for both
+    TCCR1 = _BV (PWM1A) | _BV (COM1A1) | PWM1_CLK;
+    GTCCR = _BV (COM1B1) | _BV (PWM1B);
+    OCR1C = PWM1_TOP;
+#else
     // Second PWM counter is ... weird
     TCCR1 = _BV (CS10);
     GTCCR = _BV (COM1B1) | _BV (PWM1B);
     OCR1C = 255;  // Set ceiling value to maximum
+#endif  // ifdef PLL_PWM
+#endif
+
+#ifdef OSC_CALIBRATION
+    // how the clock calibration went: 2 blinks, or a buzz to try again
+    if (clockcal != 0xffff) {
+        if (clockcal) blink(2, BLINK_SPEED/8);
+        else blink(32, 500/32/4);
+    }
 #endif
 
 #ifdef CONFIG_MODE
@@ -619,15 +1423,19 @@ int main(void)
         // Indicates they did a short press, go to the next mode
         // We don't care what the g_u8fast_presses value is as long as it's over 15
         g_u8fast_presses = (g_u8fast_presses+1) & 0x1f;
+#ifndef UI_TABLE
         next_mode(); // Will handle wrap arounds
+#endif
     } else {
         // Long press, use memorized level
         // ... or reset to the first mode
         g_u8fast_presses = 0;
+#ifndef UI_TABLE
         g_u8ramp_level = 1;
         g_i8ramp_dir = 1;
         g_u8next_mode_num = 255;
         g_u8mode_idx = 0;
+#endif
 #ifdef MEMORY
 #ifdef MEMTOGGLE
         if (g_u8memory) {
@@ -638,11 +1446,23 @@ int main(void)
 #endif  // ifdef MEMTOGGLE
 #endif  // ifdef MEMORY
     }
+#ifdef UI_TABLE
+    // the table decides where taps, fast taps, and long presses go
+    ui_boot(g_u8long_press, g_u8fast_presses);
+#endif
     g_u8long_press = 0;
 #ifdef MEMORY
     save_mode();
 #endif
 
+#ifdef FUEL_GAUGE
+    // pick up the count, and check it against the voltage before the
+    // output comes on (first reading is unreliable)
+    ADC_on();
+    get_voltage();
+    fuel_boot((uint8_t *)OPT_fuel, battery_percent(get_voltage()));
+#endif
+
     // Turn features on or off as needed
 #ifdef VOLTAGE_MON
 #ifndef THERMAL_REGULATION
@@ -658,17 +1478,24 @@ int main(void)
     uint8_t voltage;
 #endif
 #ifdef THERMAL_REGULATION
-#define THERM_HISTORY_SIZE 8
-    uint8_t temperatures[THERM_HISTORY_SIZE];
     uint8_t overheat_count = 0;
     uint8_t underheat_count = 0;
     uint8_t first_temp_reading = 1;
 #endif
-    uint8_t first_loop = 1;
-    uint8_t loop_count = 0;
     while(1) {
+        BENCH_LOOP();
+#ifdef STACK_CHECK
+        stack_check((uint8_t *)OPT_stack);
+#endif
+#ifdef FUEL_GAUGE
+        fuel_checkpoint((uint8_t *)OPT_fuel);
+#endif
+#ifdef UI_TABLE
+        mode = ui_mode();
+#else
         if (g_u8mode_idx < sizeof(g_u8modes)) mode = g_u8modes[g_u8mode_idx];
         else mode = g_u8mode_idx;
+#endif
 
 #if defined(VOLTAGE_MON) && defined(THERMAL_REGULATION)
         // make sure a voltage reading has started, for LVP purposes
@@ -680,6 +1507,46 @@ int main(void)
         }
 
 #ifdef CONFIG_MODE
+#ifdef UI_TABLE
+        // fast taps got us here; the table says where to go next
+        else if (mode == CONFIG_MENU) {
+            _delay_s();       // wait for user to stop fast-pressing button
+            g_u8fast_presses = 0;
+            ui_event(UI_TIMEOUT);
+            continue;
+        }
+#ifdef MEMTOGGLE
+        else if (mode == MEMTOGGLE_MENU) {
+            // turn g_u8memory on/off
+            // (click during the "buzz" to change the setting)
+            toggle(&g_u8memory, 1);
+            ui_event(UI_TIMEOUT);
+            continue;
+        }
+#endif
+#ifdef THERM_CALIBRATION_MODE
+        else if (mode == THERMCAL_MENU) {
+            // click during the "buzz" to calibrate
+            // (mode_override does nothing here; just a dummy value)
+#ifdef MEMTOGGLE
+            toggle(&mode_override, 2);
+#else
+            toggle(&mode_override, 1);
+#endif
+            ui_event(UI_TIMEOUT);
+            continue;
+        }
+#endif
+#ifdef CLOCK_CALIBRATION_MODE
+        else if (mode == CLOCKCAL_MENU) {
+            // click during the "buzz" to calibrate
+            // (it's the last option in the menu)
+            toggle(&mode_override, CLOCKCAL_OPTION);
+            ui_event(UI_TIMEOUT);
+            continue;
+        }
+#endif
+#else  // ifdef UI_TABLE
         else if (g_u8fast_presses > 15) {
             _delay_s();       // wait for user to stop fast-pressing button
             g_u8fast_presses = 0; // exit this mode after one use
@@ -703,10 +1570,19 @@ int main(void)
             g_u8next_mode_num = 255;
 #endif
 
+#ifdef CLOCK_CALIBRATION_MODE
+            // Enter clock calibration mode?
+            g_u8next_mode_num = CLOCK_CALIBRATION_MODE;
+            toggle(&mode_override, ++t);
+            g_u8mode_idx = 1;
+            g_u8next_mode_num = 255;
+#endif
+
             // if config mode ends with no changes,
             // pretend this is the first loop
             continue;
         }
+#endif  // ifdef UI_TABLE
 #endif  // ifdef CONFIG_MODE
 
 #ifdef MEMORY
@@ -718,7 +1594,9 @@ int main(void)
             // moon mode for half a second
             set_mode(1);
             // if the user taps quickly, go to the real moon mode
+#ifndef UI_TABLE
             g_u8next_mode_num = 1;
+#endif
 
             _delay_500ms();
 
@@ -732,273 +1610,9 @@ int main(void)
         }
 #endif
 
-        // smooth ramp mode, lets user select any output level
-        if (mode == RAMP) {
-            set_mode(g_u8ramp_level);  // turn light on
-
-            // ramp up by default
-            //if (g_u8fast_presses == 0) {
-            //    ramp_dir = 1;
-            //}
-            // double-tap to ramp down
-            //else if (g_u8fast_presses == 1) {
-            if (g_u8fast_presses == 1) {
-                g_u8next_mode_num = g_u8mode_idx;  // stay in ramping mode
-                g_i8ramp_dir = -1;             // ... but go down
-            }
-            // triple-tap to enter turbo
-            else if (g_u8fast_presses == 2) {
-                g_u8next_mode_num = g_u8mode_idx + 2;  // bypass "steady" mode
-            }
-
-            // wait a bit before actually ramping
-            // (give the user a chance to select moon, or double-tap)
-            _delay_500ms();
-
-            // if we got through the delay, assume normal operation
-            // (not trying to double-tap or triple-tap)
-            // (next mode should be normal)
-            g_u8next_mode_num = 255;
-            // ramp up on single tap
-            // (cancel earlier reversal)
-            if (g_u8fast_presses == 1) {
-                g_i8ramp_dir = 1;
-            }
-            // don't want this confusing us any more
-            g_u8fast_presses = 0;
-
-            // Just in case (SRAM could have partially decayed)
-#ifdef RAM_DECAY_PROBLEM
-            g_i8ramp_dir = (g_i8ramp_dir == 1) ? 1 : -1;
-#endif /* RAM_DECAY_PROBLEM */
-            // Do the actual ramp
-            for (;; g_u8ramp_level += g_i8ramp_dir) {
-                set_mode(g_u8ramp_level);
-                _delay_4ms(RAMP_TIME/RAMP_SIZE/4);
-                if (
-                    ((g_i8ramp_dir > 0) && (g_u8ramp_level >= RAMP_SIZE))
-                    ||
-                    ((g_i8ramp_dir < 0) && (g_u8ramp_level <= 1))
-                )
-                    break;
-            }
-            if (g_i8ramp_dir == 1) {
-#ifdef STOP_AT_TOP
-                // go to steady mode
-                g_u8mode_idx += 1;
-#endif
-#ifdef BLINK_AT_TOP
-                // blink at the top
-                set_mode(0);
-                _delay_4ms(2);
-#endif
-            }
-            g_i8ramp_dir = -g_i8ramp_dir;
-        }
-
-        else if (mode == STEADY) {
-            // normal flashlight mode
-            if (first_loop) {
-                set_mode(g_u8ramp_level);
-                target_level = g_u8ramp_level;
-            }
-            // User has 0.5s to tap again to advance to the next mode
-            //next_mode_num = 255;
-            _delay_500ms();
-            // After a delay, assume user wants to adjust ramp
-            // instead of going to next mode (unless they're
-            // tapping rapidly, in which case we should advance to turbo)
-            g_u8next_mode_num = 0;
-        }
-
-        else if (mode == TURBO) {
-            // turbo is special because it's easier to handle that way
-            if (first_loop) {
-                set_mode(RAMP_SIZE);
-                target_level = RAMP_SIZE;
-            }
-            //next_mode_num = 255;
-            _delay_500ms();
-            // go back to the previously-memorized level
-            // if the user taps after a delay,
-            // instead of advancing to blinkies
-            // (allows something similar to "momentary" turbo)
-            g_u8next_mode_num = 1;
-        }
-
-#ifdef STROBE
-        else if (mode == STROBE) {
-            // 10Hz tactical strobe
-            strobe(33/4,67/4);
-        }
-#endif // ifdef STROBE
-
-#ifdef POLICE_STROBE
-        else if (mode == POLICE_STROBE) {
-            // police-like strobe
-            strobe(20/4,40/4);
-            strobe(40/4,80/4);
-        }
-#endif // ifdef POLICE_STROBE
-
-#ifdef RANDOM_STROBE
-        else if (mode == RANDOM_STROBE) {
-            // pseudo-random strobe
-            uint8_t ms = (34 + (pgm_rand() & 0x3f))>>2;
-            //strobe(ms, ms);
-            set_level(RAMP_SIZE);
-            _delay_4ms(ms);
-            set_level(0);
-            _delay_4ms(ms);
-            //strobe(ms, ms);
-        }
-#endif // ifdef RANDOM_STROBE
-
-#ifdef BIKING_MODE
-        else if (mode == BIKING_MODE) {
-            // 2-level stutter beacon for biking and such
-            biking_mode(RAMP_SIZE/2, RAMP_SIZE);
-        }
-#endif  // ifdef BIKING_MODE
-
-#ifdef BIKING_MODE2
-        else if (mode == BIKING_MODE2) {
-            // 2-level stutter beacon for biking and such
-            biking_mode(RAMP_SIZE/4, RAMP_SIZE/2);
-        }
-#endif  // ifdef BIKING_MODE
-
-#ifdef SOS
-        else if (mode == SOS) {
-            SOS_mode();
-        }
-#endif // ifdef SOS
-
-#ifdef HEART_BEACON
-        else if (mode == HEART_BEACON) {
-            set_mode(RAMP_SIZE);
-            _delay_4ms(1);
-            set_mode(0);
-            _delay_4ms(250/4);
-            set_mode(RAMP_SIZE);
-            _delay_4ms(1);
-            set_mode(0);
-            _delay_4ms(750/4);
-        }
-#endif
-
-#ifdef PARTY_STROBE12
-        else if (mode == PARTY_STROBE12) {
-            party_strobe_loop(1,79);
-        }
-#endif
-
-#ifdef PARTY_STROBE24
-        else if (mode == PARTY_STROBE24) {
-            party_strobe_loop(0,41);
-        }
-#endif
-
-#ifdef PARTY_STROBE60
-        else if (mode == PARTY_STROBE60) {
-            party_strobe_loop(0,15);
-        }
-#endif
-
-#ifdef PARTY_VARSTROBE1
-        else if (mode == PARTY_VARSTROBE1) {
-            uint8_t j, speed;
-            for(j=0; j<66; j++) {
-                if (j<33) {
-                    speed = j;
-                }
-                else {
-                    speed = 66-j;
-                }
-                party_strobe(1,(speed+33-6)<<1);
-            }
-        }
-#endif
-
-#ifdef PARTY_VARSTROBE2
-        else if (mode == PARTY_VARSTROBE2) {
-            uint8_t j, speed;
-            for(j=0; j<100; j++) {
-                if (j<50) {
-                    speed = j;
-                }
-                else {
-                    speed = 100-j;
-                }
-                party_strobe(0, speed+9);
-            }
-        }
-#endif
-
-#ifdef BATTCHECK
-        // battery check mode, show how much power is left
-        else if (mode == BATTCHECK) {
-            _delay_500ms();
-#ifdef BATTCHECK_VpT
-            // blink out volts and tenths
-            uint8_t result = battcheck();
-            blink(result >> 5, BLINK_SPEED/5);
-            _delay_4ms(BLINK_SPEED*2/3);
-            blink(1,8/4);
-            _delay_4ms(BLINK_SPEED*4/3);
-            blink(result & 0b00011111, BLINK_SPEED/5);
-#else  // ifdef BATTCHECK_VpT
-            // blink zero to five times to show voltage
-            // (or zero to nine times, if 8-bar mode)
-            // (~0%, ~25%, ~50%, ~75%, ~100%, >100%)
-            blink(battcheck(), BLINK_SPEED/4);
-#endif  // ifdef BATTCHECK_VpT
-            // wait between readouts
-            _delay_s();
-            _delay_s();
-        }
-#endif // ifdef BATTCHECK
+        // everything else goes through the mode registry
+        run_mode(mode);
 
-#ifdef GOODNIGHT
-        // "good night" mode, slowly ramps down and shuts off
-        else if (mode == GOODNIGHT) {
-            uint8_t i, j;
-            // signal that this is *not* the STEADY mode
-            blink(2, BLINK_SPEED/16);
-#define GOODNIGHT_TOP (RAMP_SIZE/6)
-            // ramp up instead of going directly to the top level
-            // (probably pointless in this UI)
-            /*
-            for (i=1; i<=GOODNIGHT_TOP; i++) {
-                set_mode(i);
-                _delay_4ms(2*RAMP_TIME/RAMP_SIZE/4);
-            }
-            */
-            // ramp down over about an hour
-            for(i=GOODNIGHT_TOP; i>=1; i--) {
-                set_mode(i);
-                // how long the down ramp should last, in seconds
-#define GOODNIGHT_TIME 60*60
-                // how long does _delay_s() actually last, in seconds?
-                // (calibrate this per driver, probably)
-#define ONE_SECOND 1.03
-#define GOODNIGHT_STEPS (1+GOODNIGHT_TOP)
-#define GOODNIGHT_LOOPS (uint8_t)((GOODNIGHT_TIME) / ((2*ONE_SECOND) * GOODNIGHT_STEPS))
-                // NUM_LOOPS = (60*60) / ((2*ONE_SECOND) * (1+MODE_LOW-MODE_MOON))
-                // (where ONE_SECOND is how many seconds _delay_s() actually lasts)
-                // (in my case it's about 0.89)
-                for(j=0; j<GOODNIGHT_LOOPS; j++) {
-                    _delay_s();
-                    _delay_s();
-                    //_delay_ms(10);
-                }
-            }
-            poweroff();
-        }
-#endif // ifdef GOODNIGHT
-
-        else {  // shouldn't happen  (compiler omits this entire clause)
-        }
         g_u8fast_presses = 0;
 
 
@@ -1018,16 +1632,20 @@ int main(void)
                 // DEBUG: blink on step-down:
                 //set_level(0);  _delay_ms(100);
 
-                if (mode != STEADY) {
+                if (! (mode_flags(mode) & MODE_LVP_STEP)) {
+#ifdef PARTY_STROBES
+                    // hand Timer0 back to PWM, in case a strobe is running
+                    strobe_stop();
+#endif
                     // step "down" from special g_u8modes to medium-low
-                    g_u8mode_idx = 1;
+                    g_u8mode_idx = STEADY_IDX;
                     //mode = STEADY;
                     g_u8ramp_level = RAMP_SIZE/4;
                 }
                 else {
                     if (g_u8ramp_level > 1) {  // solid non-moon mode
-                        // drop by 50% each time
-                        g_u8ramp_level = (actual_level >> 1);
+                        // drop by the battery profile's step each time
+                        g_u8ramp_level = lvp_step(actual_level);
                     } else { // Already at the lowest mode
                         // Turn off the light
                         poweroff();
@@ -1048,9 +1666,11 @@ int main(void)
 #endif  // ifdef VOLTAGE_MON
 
 #ifdef THERMAL_REGULATION
-        if ((mode == STEADY) || (mode == TURBO) || (mode == THERM_CALIBRATION_MODE)) {
+        if (mode_flags(mode) & MODE_THERMAL) {
             // how far ahead should we predict?
-#define THERM_PREDICTION_STRENGTH 4
+            // (sense_slope() is the change over 84 ring entries of 8
+            //  readings each, so 3 means 84 readings ahead)
+#define THERM_PREDICTION_STRENGTH 3
             // how proportional should the adjustments be?
 #define THERM_DIFF_ATTENUATION 4
             // how low is the lowpass filter?
@@ -1065,51 +1685,52 @@ int main(void)
 
             int16_t temperature = current_temperature();
             int16_t projected;  // Fight the future!
-            int16_t diff;
 
             // initial setup, only once
             if (first_temp_reading) {
                 first_temp_reading = 0;
-                for (uint8_t t=0; t<THERM_HISTORY_SIZE; t++)
-                    temperatures[t] = temperature;
+                sense_reset(temperature);
             }
 
-            // rotate measurements and add a new one
-            for(uint8_t t=0; t<THERM_HISTORY_SIZE-1; t++) {
-                temperatures[t] = temperatures[t+1];
-            }
-            temperatures[THERM_HISTORY_SIZE-1] = temperature;
+            // drop spikes, smooth out noise, and remember it
+            temperature = sense_add(temperature);
 
             // guess what the temp will be several seconds in the future
-            diff = temperature - temperatures[0];
-            projected = temperature + (diff<<THERM_PREDICTION_STRENGTH);
+            // (a straight line through the recent readings, extended)
+            projected = temperature + (sense_slope() >> THERM_PREDICTION_STRENGTH);
 
             // never step down in thermal calibration mode
             if (mode == THERM_CALIBRATION_MODE) {
+                // convert 13.2 fixed-point to whole degrees C
+                uint8_t celsius = (temperature < 0) ? 0 : (temperature >> 2);
+                uint8_t result;
                 if (first_loop) {
                     // TODO: blink out current temperature limit
                     // let user set default or max limit?
                     therm_ceil = DEFAULT_THERM_CEIL;
                     set_mode(RAMP_SIZE/4);
-                    save_state();
+                    eeprom_write_byte((uint8_t *)OPT_therm_ceil, therm_ceil);
                     _delay_s();
                     _delay_s();
                     // turn power up all the way for calibration purposes
                     set_mode(RAMP_SIZE);
+                    thermcal_start(therm_ceil, celsius);
                 }
-                // use the current temperature as the new ceiling value
-                //tempCeil = projected >> 2;
-                // less aggressive prediction
-                therm_ceil = (temperature + (diff<<(THERM_PREDICTION_STRENGTH-1))) >> 2;
-                // Don't let user exceed maximum limit
-                if (therm_ceil > MAX_THERM_CEIL) {
-                    therm_ceil = MAX_THERM_CEIL;
+                // the hottest it gets is the new ceiling value
+                // (saved as it climbs, at most about once per degree)
+                result = thermcal_sample(celsius, MAX_THERM_CEIL);
+                if (result & THERMCAL_SAVE) {
+                    therm_ceil = thermcal_peak;
+                    eeprom_write_byte((uint8_t *)OPT_therm_ceil, therm_ceil);
                 }
-                // save state periodically (but not too often)
-                if (loop_count > 3)
-                {
-                    loop_count = 0;
-                    save_state();
+                if (result & THERMCAL_DONE) {
+                    // it has leveled off; no need to keep cooking it
+                    // (go to steady mode at a comfortable level)
+                    blink(2, BLINK_SPEED/8);
+                    g_u8mode_idx = STEADY_IDX;
+                    g_u8ramp_level = RAMP_SIZE/4;
+                    set_mode(g_u8ramp_level);
+                    target_level = g_u8ramp_level;
                 }
                 // don't repeat for a little while
                 _delay_500ms();
@@ -1164,7 +1785,6 @@ int main(void)
 #endif  // ifdef THERMAL_REGULATION
 
         first_loop = 0;
-        loop_count ++;
     }
 
 }
@@ -42,6 +42,12 @@
 
 // uncomment to ramp up/down to a mode instead of jumping directly
 //#define SOFT_START
+//#define SOFT_START_TIME 256  // about how long a transition takes, in ms
+//#define SOFT_START_LINEAR     // even steps instead of easing in
+
+// Battery type, for LVP and battcheck (profiles are in tk-calibration.h)
+//#define CHEMISTRY CHEM_LIFEPO4  // default is CHEM_LIION; or CHEM_NIMH3
+//#define CHEM_SELECT         // all profiles, chosen by EEPROM byte OPT_chem
 
 // Enable battery indicator mode?
 #define USE_BATTCHECK
@@ -76,6 +82,10 @@
 //#define POLICE_STROBE 248
 //#define RANDOM_STROBE 247
 //#define SOS 246
+// Uncomment to let the user reprogram the first few mode groups
+// (replaces some of the built-in groups, see tk-usergroups.h)
+//#define GROUP_PROGRAM_MODE 245  // let user set the levels in a group
+//#define NUM_USER_GROUPS 2       // how many groups can be reprogrammed
 
 // thermal step-down
 //#define TEMPERATURE_MON
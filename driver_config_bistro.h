@@ -23,9 +23,17 @@
 
 #define VOLTAGE_MON         // Comment out to disable LVP
 
+// Scale FET PWM with battery voltage for constant brightness
+// (as long as there's headroom; see tk-vcomp.h for VCOMP_* tuning)
+//#define VOLTAGE_COMP
+
 #define OFFTIM3             // Use short/med/long off-time presses
 // instead of just short/long
 
+// Time presses with a per-driver OTC decay model instead of raw readings
+// (uncalibrated, it acts the same; config option 10 calibrates it)
+//#define OTC_MODEL
+
 // ../../bin/level_calc.py 64 1 10 1300 y 3 0.23 140
 #define RAMP_SIZE  64
 // log curve
@@ -43,6 +51,12 @@
 
 // uncomment to ramp up/down to a mode instead of jumping directly
 #define SOFT_START
+//#define SOFT_START_TIME 256  // about how long a transition takes, in ms
+//#define SOFT_START_LINEAR     // even steps instead of easing in
+
+// Battery type, for LVP and battcheck (profiles are in tk-calibration.h)
+//#define CHEMISTRY CHEM_LIFEPO4  // default is CHEM_LIION; or CHEM_NIMH3
+//#define CHEM_SELECT         // all profiles, chosen by EEPROM byte OPT_chem
 
 // Enable battery indicator mode?
 #define USE_BATTCHECK
@@ -76,6 +90,17 @@
 #define POLICE_STROBE 248
 //#define RANDOM_STROBE 247
 //#define SOS 246
+// Uncomment to let the user reprogram the first few mode groups
+// (replaces some of the built-in groups, see tk-usergroups.h)
+//#define GROUP_PROGRAM_MODE 245  // let user set the levels in a group
+//#define NUM_USER_GROUPS 2       // how many groups can be reprogrammed
+#ifdef OTC_MODEL
+#define OTC_CAL_MODE 244        // guided OTC calibration (see tk-otc.h)
+#endif
+
+// Uncomment to record the lowest stack headroom seen in EEPROM
+// (see tk-stackcheck.h)
+//#define STACK_CHECK
 
 // thermal step-down
 #define TEMPERATURE_MON
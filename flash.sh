@@ -1,3 +1,22 @@
 #/bin/sh
+# usage: flash.sh [attiny13|attiny25|attiny45|attiny85] firmware.hex [settings.eep]
+# (make a .eep with Scripts/eep_gen.py to preconfigure the light, with the
+#  same --mcu)
+MCU=attiny13
+case "$1" in
+  attiny*) MCU=$1 ; shift ;;
+esac
+case "$MCU" in
+  # 4.8 MHz, no BOD
+  attiny13) PART=t13 ; FUSES="-Ulfuse:w:0x75:m -Uhfuse:w:0xFF:m" ;;
+  # 8 MHz, BOD at 1.8V
+  attiny25|attiny45|attiny85)
+    PART=t${MCU#attiny} ; FUSES="-Ulfuse:w:0xd2:m -Uhfuse:w:0xde:m -Uefuse:w:0xff:m" ;;
+  *) echo "Unknown MCU: $MCU" ; exit 1 ;;
+esac
 FIRMWARE=$1
-avrdude -c usbasp -p t13 -u -Uflash:w:$FIRMWARE -Ulfuse:w:0x75:m -Uhfuse:w:0xFF:m
+EEPROM=
+if [ -n "$2" ]; then
+  EEPROM="-Ueeprom:w:$2"
+fi
+avrdude -c usbasp -p $PART -u -Uflash:w:$FIRMWARE $EEPROM $FUSES
@@ -37,6 +37,13 @@
 #define EEPSIZE 128
 #define V_REF REFS1
 #define BOGOMIPS (F_CPU/4000)
+// registers and bits which are named differently on attiny13
+#define TIMSK0 TIMSK
+#define TIFR0 TIFR
+#define WDTIE WDIE
+#define WDTIF WDIF
+// VCC reference, right-adjust, 1.1V bandgap as input (for VOLTAGE_BANDGAP)
+#define BANDGAP_CHANNEL 0x0c
 #else
 Hey, you need to define ATTINY.
 #endif
@@ -95,7 +102,11 @@ Hey, you need to define ATTINY.
 #define CAP_DIDR    ADC3D   // Digital input disable bit corresponding with PB3
 
 #define PWM_PIN     PB1     // pin 6, 6x7135 PWM
+#ifdef PLL_PWM
+#define PWM_LVL     OCR1A   // PB1 moves to Timer1 (OC1A) for high-speed PWM
+#else
 #define PWM_LVL     OCR0B   // OCR0B is the output compare register for PB1
+#endif
 #define ALT_PWM_PIN PB0     // pin 5, 1x7135 PWM
 #define ALT_PWM_LVL OCR0A   // OCR0A is the output compare register for PB0
 #define FET_PWM_PIN PB4     // pin 3
@@ -109,8 +120,15 @@ Hey, you need to define ATTINY.
 //#define TEMP_DIDR   ADC4D
 #define TEMP_CHANNEL 0b00001111
 
+#ifdef PLL_PWM
+// Only the 1x7135 is left on Timer0, and phase-correct mode is audible
+// at this clock speed, so use fast PWM for it all the time.
+#define FAST 0x83           // fast PWM channel A only
+#define PHASE 0x83          // (not phase-correct; see above)
+#else
 #define FAST 0xA3           // fast PWM both channels
 #define PHASE 0xA1          // phase-correct PWM both channels
+#endif
 
 #endif  // LAYOUT_TRIPLEDOWN
 
@@ -123,7 +141,21 @@ Hey, you need to define ATTINY.
  *      GND -|4  5|- Green LED
  *            ----
  */
-// TODO: fill in this section, update Ferrero_Rocher code to use it.
+
+#define SWITCH_PIN   PB3    // pin 2, E-switch (active low, uses pull-up)
+#define SWITCH_PCINT PCINT3 // pin change interrupt for the switch
+
+#define RED_PIN     PB4     // pin 3, red indicator LED
+#define GREEN_PIN   PB0     // pin 5, green indicator LED
+
+#define PWM_PIN     PB1     // pin 6
+#define PWM_LVL     OCR0B   // OCR0B is the output compare register for PB1
+
+#define VOLTAGE_PIN PB2     // pin 7, voltage ADC
+#define ADC_CHANNEL 0x01    // MUX 01 corresponds with PB2
+#define ADC_DIDR    ADC1D   // Digital input disable bit corresponding with PB2
+#define ADC_PRSCL   0x06    // clk/64
+
 #define FAST 0x23           // fast PWM channel 1 only
 #define PHASE 0x21          // phase-correct PWM channel 1 only
 #endif  // LAYOUT_FERRERO_ROCHER
@@ -166,6 +198,11 @@ Hey, you need to define ATTINY.
 
 #define PWM_LVL     OCR0B   // OCR0B is the output compare register for PB1
 
+// optional NTC thermistor to ground on Star 4 (see tk-ntc.h)
+#define NTC_PIN     PB3
+#define NTC_CHANNEL 0x03    // MUX 03 corresponds with PB3 (Star 4)
+#define NTC_DIDR    ADC3D   // Digital input disable bit corresponding with PB3
+
 #define FAST 0x23           // fast PWM channel 1 only
 #define PHASE 0x21          // phase-correct PWM channel 1 only
 
@@ -179,4 +216,19 @@ Hey, you need to define ATTINY.
 Hey, you need to define an I/O pin layout.
 #endif
 
+/******************** PLL-clocked Timer1 PWM ****************************/
+#ifdef PLL_PWM
+#if (ATTINY == 13)
+Hey, attiny13 has no PLL or Timer1.  Turn off PLL_PWM.
+#endif
+// PWM frequency = 64 MHz / prescaler / (PWM1_TOP+1)
+// The PLL needs VCC > 2.7V for 64 MHz (set LSM in PLLCSR for 32 MHz below).
+#ifndef PWM1_TOP
+#define PWM1_TOP    255     // OCR1C; lower is faster PWM but fewer steps
+#endif
+#ifndef PWM1_CLK
+#define PWM1_CLK    0x03    // CS13..CS10: 1 => PCK, 2 => PCK/2, 3 => PCK/4...
+#endif
+#endif  // PLL_PWM
+
 #endif  // TK_ATTINY_H
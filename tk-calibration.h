@@ -22,6 +22,35 @@
  */
 
 /********************** Voltage ADC calibration **************************/
+#ifdef VOLTAGE_BANDGAP
+// Bandgap measurement (see tk-voltage.h) is already in 20mV units,
+// so these are just volts * 50.
+#define ADC_44     220
+#define ADC_43     215
+#define ADC_42     210
+#define ADC_41     205
+#define ADC_40     200
+#define ADC_39     195
+#define ADC_38     190
+#define ADC_37     185
+#define ADC_36     180
+#define ADC_35     175
+#define ADC_34     170
+#define ADC_33     165
+#define ADC_32     160
+#define ADC_31     155
+#define ADC_30     150
+#define ADC_29     145
+#define ADC_28     140
+#define ADC_27     135
+#define ADC_26     130
+#define ADC_25     125
+#define ADC_24     120
+#define ADC_23     115
+#define ADC_22     110
+#define ADC_21     105
+#define ADC_20     100
+#else
 // These values were measured using RMM's FET+7135.
 // See battcheck/readings.txt for reference values.
 // the ADC values we expect for specific voltages
@@ -50,14 +79,73 @@
 #define ADC_22     99
 #define ADC_21     95
 #define ADC_20     91
+#endif  // VOLTAGE_BANDGAP
+
+
+/********************** Battery chemistry profiles ***********************/
+// Each profile has:
+//   LOW   when do we start stepping down (under load)
+//   CRIT  when do we shut the light off
+//   STEP  how much is left after each LVP step-down, in 8ths
+//   SOC   resting voltage at 0%, 12.5%, 25% ... 100% charge (9 points,
+//         rising); battcheck interpolates between them.  "+1" is about
+//         20mV, for the flat parts.
+// Pick one with CHEMISTRY, or put them all in flash and pick one from
+// EEPROM at runtime with CHEM_SELECT (see tk-voltage.h).
+#define CHEM_LIION    0
+#define CHEM_LIFEPO4  1
+#define CHEM_NIMH3    2
+#define CHEM_COUNT    3
+
+// Li-ion / Li-po, 1 cell
+#define LIION_LOW     ADC_30
+#define LIION_CRIT    ADC_27
+#define LIION_STEP    4       // drop by half
+#define LIION_SOC     ADC_30,ADC_33,ADC_35,ADC_37,ADC_38,ADC_39,ADC_40,ADC_41,ADC_42
+
+// LiFePO4, 1 cell: flat most of the way, then a cliff, so step down hard
+#define LIFEPO4_LOW   ADC_28
+#define LIFEPO4_CRIT  ADC_25
+#define LIFEPO4_STEP  2       // drop to a quarter
+#define LIFEPO4_SOC   ADC_29,ADC_32,ADC_32+1,ADC_32+2,ADC_33,ADC_33+1,ADC_33+2,ADC_34,ADC_35
+
+// NiMH, 3 cells in series: 1.0V per cell under load, 0.9V per cell to
+// protect the weakest one from reversing
+#define NIMH3_LOW     ADC_30
+#define NIMH3_CRIT    ADC_27
+#define NIMH3_STEP    6       // sags slowly, so step down gently
+#define NIMH3_SOC     ADC_33,ADC_35,ADC_36,ADC_36+2,ADC_37,ADC_38,ADC_38+2,ADC_39,ADC_41
+
+#ifndef CHEMISTRY
+#define CHEMISTRY CHEM_LIION
+#endif
+#if (CHEMISTRY == CHEM_LIFEPO4)
+#define CHEM_LOW      LIFEPO4_LOW
+#define CHEM_CRIT     LIFEPO4_CRIT
+#define CHEM_STEP     LIFEPO4_STEP
+#define CHEM_SOC      LIFEPO4_SOC
+#elif (CHEMISTRY == CHEM_NIMH3)
+#define CHEM_LOW      NIMH3_LOW
+#define CHEM_CRIT     NIMH3_CRIT
+#define CHEM_STEP     NIMH3_STEP
+#define CHEM_SOC      NIMH3_SOC
+#else
+#define CHEM_LOW      LIION_LOW
+#define CHEM_CRIT     LIION_CRIT
+#define CHEM_STEP     LIION_STEP
+#define CHEM_SOC      LIION_SOC
+#endif
 
-#define ADC_100p   ADC_42  // the ADC value for 100% full (resting)
-#define ADC_75p    ADC_40  // the ADC value for 75% full (resting)
-#define ADC_50p    ADC_38  // the ADC value for 50% full (resting)
-#define ADC_25p    ADC_35  // the ADC value for 25% full (resting)
-#define ADC_0p     ADC_30  // the ADC value for 0% full (resting)
-#define ADC_LOW    ADC_30  // When do we start ramping down
-#define ADC_CRIT   ADC_27  // When do we shut the light off
+#ifdef CHEM_SELECT
+// read from the active profile at runtime (see tk-voltage.h)
+#define ADC_LOW    chem_read(0)
+#define ADC_CRIT   chem_read(1)
+#define LVP_STEP   chem_read(2)
+#else
+#define ADC_LOW    CHEM_LOW   // When do we start ramping down
+#define ADC_CRIT   CHEM_CRIT  // When do we shut the light off
+#define LVP_STEP   CHEM_STEP  // How much is left after each step-down
+#endif
 
 
 /********************** Offtime capacitor calibration ********************/
@@ -72,6 +160,15 @@
 // Between CAP_MED and CAP_SHORT is a "medium press"
 #define CAP_MED             94
 // Below CAP_MED is a long press
+#ifdef OTC_MODEL
+// With OTC_MODEL, the same boundaries are times instead, in ms
+#define OTC_SHORT_MS        500
+#define OTC_MED_MS          1500
+// Decay model for uncalibrated drivers (see tk-otc.h), which puts the
+// boundaries in the same places as CAP_SHORT and CAP_MED above
+#define OTC_LEVEL           194
+#define OTC_RATE            123
+#endif
 #else
 // The OTC value 1.0s after being disconnected from power
 // Anything higher than this is a short press, lower is a long press
@@ -79,4 +176,16 @@
 #endif
 
 
+/********************** NTC thermistor calibration ***********************/
+// Only used with THERM_NTC (see tk-ntc.h).  Generate this for your
+// thermistor and fixed resistor with Scripts/ntc_calc.py .
+#ifndef NTC_TABLE
+// Scripts/ntc_calc.py --r25 100000 --beta 3950 --rfixed 22000 --tmin 0 --tmax 120
+// 27 entries, worst error 0.50 C, 9.0 ADC counts per C at 60 C
+#define NTC_SUM_MIN 1277
+#define NTC_SHIFT 8
+#define NTC_TABLE 120,112,104,98,93,88,83,79,75,71,67,63,60,56,53,49,46,42,39,35,30,26,21,15,9,0,0
+#endif
+
+
 #endif  // TK_CALIBRATION_H
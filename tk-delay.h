@@ -23,6 +23,15 @@
 #ifdef OWN_DELAY
 #include "tk-attiny.h"
 #include <util/delay_basic.h>
+// Background work while waiting (like soft start transitions):
+// #define DELAY_HOOK as a function name before including this file, and it
+// gets called with how many ms just went by.  Keep it short.
+#ifdef DELAY_HOOK
+void DELAY_HOOK(uint8_t ms);
+#define delay_hook(ms) DELAY_HOOK(ms)
+#else
+#define delay_hook(ms)
+#endif
 #ifdef USE_DELAY_MS
 // Having own _delay_ms() saves some bytes AND adds possibility to use variables as input
 void _delay_ms(uint16_t n)
@@ -35,7 +44,10 @@ void _delay_ms(uint16_t n)
     //    while(n-- > 0) _delay_loop_2(BOGOMIPS);
     //}
     //#else
-    while(n-- > 0) _delay_loop_2(BOGOMIPS);
+    while(n-- > 0) {
+        _delay_loop_2(BOGOMIPS);
+        delay_hook(1);
+    }
     //#endif
 }
 #endif
@@ -47,7 +59,10 @@ void _delay_zero() {
 #ifdef USE_DELAY_4MS
 void _delay_4ms(uint8_t n)  // because it saves a bit of ROM space to do it this way
 {
-    while(n-- > 0) _delay_loop_2(BOGOMIPS*4);
+    while(n-- > 0) {
+        _delay_loop_2(BOGOMIPS*4);
+        delay_hook(4);
+    }
 }
 #endif
 #ifdef USE_DELAY_S
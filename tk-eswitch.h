@@ -0,0 +1,209 @@
+#ifndef TK_ESWITCH_H
+#define TK_ESWITCH_H
+/*
+ * Electronic switch support, for clicky-switch UIs.
+ * Lets a UI written for a power-cutting clicky switch run on a light with
+ * an e-switch instead, by making the e-switch act like a clicky:
+ *
+ *   - Tap (press and release quickly): the MCU resets, but RAM survives,
+ *     exactly like a short half-press on a clicky.  So multi-taps are
+ *     counted by the UI the same way it already does (g_u8fast_presses).
+ *   - Hold (ESWITCH_HOLD_TIME or longer): the light turns off and the
+ *     MCU goes into a deep standby, which is the e-switch version of
+ *     clicking the light off.
+ *   - Press from standby: the light starts up as if it had been off for
+ *     a long time.
+ *
+ * While the light is on, the watchdog interrupts every 16ms to sample the
+ * switch.  A press has to be seen on ESWITCH_DEBOUNCE samples in a row to
+ * count.  Once it does, the output goes dark (like a clicky cutting the
+ * power) and the handler times the press until it's released or becomes
+ * a hold.  The UI is frozen during that time, like it would be with no
+ * power.
+ *
+ * In standby everything is turned off except the pin change interrupt for
+ * the switch: no watchdog, no ADC, no comparator, no brown-out detector
+ * during sleep (where the chip allows it), and timers are clock-gated.
+ * The switch pull-up only draws current while pressed.  This gets the MCU
+ * well under a microamp; the voltage divider on the battery is then the
+ * biggest drain, so use large resistors on e-switch drivers.
+ *
+ * Needs SWITCH_PIN and SWITCH_PCINT from the layout in tk-attiny.h.
+ * Call eswitch_init() early in main(), after unused pins are pulled up,
+ * and use eswitch_off() in place of a clicky "poweroff".
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SWITCH_PIN
+Hey, this layout has no SWITCH_PIN for tk-eswitch.h.
+#endif
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+#include <util/delay_basic.h>
+
+// samples in a row (16ms each) before a press counts
+#ifndef ESWITCH_DEBOUNCE
+#define ESWITCH_DEBOUNCE 2
+#endif
+// a press this long (in ms) turns the light off
+#ifndef ESWITCH_HOLD_TIME
+#define ESWITCH_HOLD_TIME 500
+#endif
+
+#define ESWITCH_OFF 0x3c  // asks the next boot to go to standby
+
+#define switch_pressed() (! (PINB & (1 << SWITCH_PIN)))
+// plain busy-wait, without tk-delay.h's hook (nothing else should run here)
+#define eswitch_wait_4ms() _delay_loop_2(BOGOMIPS*4)
+
+// survives the watchdog reset used for taps
+uint8_t g_u8eswitch_off __attribute__ ((section (".noinit")));
+uint8_t eswitch_count;  // debounce samples so far
+
+/*
+ * Prototypes
+ */
+uint8_t eswitch_init();
+void eswitch_off();
+void eswitch_reset();
+static inline void eswitch_standby();
+static inline void eswitch_dark();
+
+/*
+ * Code
+ */
+
+void eswitch_reset() {
+    // Watchdog reset: all the hardware starts fresh, but RAM stays,
+    // which is what a quick tap on a clicky does.
+    wdt_enable(WDTO_15MS);
+    while (1) {}
+}
+
+void eswitch_off() {
+    // make the next boot go into standby
+    g_u8eswitch_off = ESWITCH_OFF;
+    eswitch_reset();
+}
+
+static inline void eswitch_dark() {
+    // Output off, regardless of what the UI is doing.  It's all reset
+    // afterward, so there's no need to put anything back.
+    TCCR0A = 0;
+    PORTB &= ~(1 << PWM_PIN);
+#ifdef ALT_PWM_PIN
+    PORTB &= ~(1 << ALT_PWM_PIN);
+#endif
+#ifdef FET_PWM_PIN
+    GTCCR = 0;
+    PORTB &= ~(1 << FET_PWM_PIN);
+#endif
+}
+
+static inline void eswitch_standby() {
+    // Called right after a reset, so the timers are already stopped and
+    // the outputs are already off.  Just shut down the rest.
+    ADCSRA = 0;
+    ACSR = (1 << ACD);  // analog comparator off
+#ifdef ADC_DIDR
+    // the divider sits at mid-rail, where a digital input leaks current
+    DIDR0 |= (1 << ADC_DIDR);
+#endif
+#ifdef PRR
+    PRR = 0xff;  // clock-gate everything we can
+#endif
+    // wake on any change of the switch pin
+    PCMSK = (1 << SWITCH_PCINT);
+    GIMSK |= (1 << PCIE);
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+
+    while (1) {
+        cli();
+        sleep_enable();
+#if defined(BODS) && defined(BODSE)
+        sleep_bod_disable();  // has to be right before sleeping
+#endif
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        // ignore bounces and glitches: only wake for a real press
+        for (eswitch_count = 0; eswitch_count < 16/4; eswitch_count++)
+            eswitch_wait_4ms();
+        if (switch_pressed()) break;
+    }
+
+    GIMSK &= ~(1 << PCIE);
+#ifdef PRR
+    PRR = 0;
+#endif
+    // start on release, like a clicky, so the release isn't a tap
+    while (switch_pressed()) {}
+    for (eswitch_count = 0; eswitch_count < 32/4; eswitch_count++)
+        eswitch_wait_4ms();
+    eswitch_count = 0;
+}
+
+uint8_t eswitch_init() {
+    // Returns 1 after waking from standby (so the UI should start fresh),
+    // 0 after a tap (so it should carry on where it left off).
+    uint8_t tapped = (MCUSR & (1 << WDRF)) && (g_u8eswitch_off != ESWITCH_OFF);
+    uint8_t woke = 0;
+
+    // the watchdog stays on after a watchdog reset, so stop it first
+    MCUSR = 0;
+    wdt_disable();
+    g_u8eswitch_off = 0;
+    PORTB |= (1 << SWITCH_PIN);  // pull-up
+
+    // Power-on, brown-out, or a hold: wait in standby for a press.
+    // (so putting a battery in doesn't turn the light on)
+    if (! tapped) {
+        eswitch_standby();
+        woke = 1;
+    }
+
+    // sample the switch every 16ms from now on
+    WDTCR = (1 << WDTIE);
+    sei();
+
+    return woke;
+}
+
+EMPTY_INTERRUPT(PCINT0_vect);
+
+ISR(WDT_vect) {
+    uint16_t held;
+
+    if (! switch_pressed()) {
+        eswitch_count = 0;
+        return;
+    }
+    if (++eswitch_count < ESWITCH_DEBOUNCE) return;
+
+    // it's a real press: go dark and see how long it lasts
+    eswitch_dark();
+    for (held = ESWITCH_DEBOUNCE * 16; held < ESWITCH_HOLD_TIME; held += 4) {
+        if (! switch_pressed()) eswitch_reset();  // tap
+        eswitch_wait_4ms();
+    }
+    eswitch_off();  // hold
+}
+
+#endif  // TK_ESWITCH_H
@@ -0,0 +1,109 @@
+#ifndef TK_FIREFLY_H
+#define TK_FIREFLY_H
+/*
+ * Firefly: output levels below the lowest PWM level.
+ * A PWM level of a few counts is only a microsecond or so per cycle, which
+ * is too short for a 7135 to turn on, so below some level there's just no
+ * light.  Firefly does the opposite: a full-on pulse long enough for the
+ * regulator to actually regulate (tens of microseconds), but only once per
+ * watchdog tick (~16ms).  The MCU can sleep in between, so a light sitting
+ * at a firefly level draws a fraction of a milliamp and runs for weeks.
+ *
+ *   350mA 7135, 16us pulse every 16ms  ->  ~0.35mA average for the LED
+ *
+ * Options:
+ *   FIREFLY_PULSES  pulse widths, dimmest first, as FIREFLY_US(us) values
+ *                   (3 CPU cycles per unit, so 255 is ~160us at 4.8MHz;
+ *                   the interrupt itself adds a few us to each)
+ *
+ * Drives PWM_PIN directly, so Timer0 has to be the one doing PWM on it
+ * (no PLL_PWM), and it needs the watchdog (no e-switch).
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef SWITCH_PIN
+Hey, FIREFLY needs the watchdog, which tk-eswitch.h already uses.
+#endif
+#ifdef PLL_PWM
+Hey, FIREFLY pulses PWM_PIN directly, so it has to be on Timer0.
+#endif
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/delay_basic.h>
+
+// pulse width in us, to _delay_loop_1() counts
+#define FIREFLY_US(us) ((uint8_t)((us) * (F_CPU / 1000000.0) / 3))
+#ifndef FIREFLY_PULSES
+#define FIREFLY_PULSES FIREFLY_US(8), FIREFLY_US(16), FIREFLY_US(32), FIREFLY_US(64)
+#endif
+
+PROGMEM const uint8_t firefly_pulses[] = { FIREFLY_PULSES };
+#define FIREFLY_LEVELS sizeof(firefly_pulses)
+
+volatile uint8_t firefly_width;  // 0 when not in firefly
+
+/*
+ * Prototypes
+ */
+void firefly_on(uint8_t level);
+void firefly_off();
+void firefly_sleep(uint8_t ticks);
+
+/*
+ * Code
+ */
+
+void firefly_on(uint8_t level) {
+    // level is 1 to FIREFLY_LEVELS
+    firefly_width = pgm_read_byte(firefly_pulses + level - 1);
+    // PWM lets go of the pins, so PORTB drives them (and they're all low)
+    TCCR0A = 0;
+    WDTCR = (1 << WDTIE);  // interrupt every 16ms
+    sei();
+}
+
+void firefly_off() {
+    firefly_width = 0;
+    WDTCR = 0;
+}
+
+void firefly_sleep(uint8_t ticks) {
+    // Like _delay_4ms(ticks*4), but asleep between pulses while in firefly.
+    // (a transition can move out of firefly partway, so check each time,
+    //  or nothing would wake us up)
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    while (ticks--) {
+        if (firefly_width) {
+            sleep_mode();
+            delay_hook(16);
+        } else {
+            _delay_4ms(16/4);
+        }
+    }
+}
+
+ISR(WDT_vect) {
+    if (firefly_width) {
+        PORTB |= (1 << PWM_PIN);
+        _delay_loop_1(firefly_width);
+        PORTB &= ~(1 << PWM_PIN);
+    }
+}
+
+#endif  // TK_FIREFLY_H
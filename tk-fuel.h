@@ -0,0 +1,188 @@
+#ifndef TK_FUEL_H
+#define TK_FUEL_H
+/*
+ * Fuel gauge: how much charge is left, by counting it out.
+ *
+ * Resting voltage says little in the middle of a Li-ion discharge, where
+ * the curve is nearly flat, so this adds up the current drawn instead:
+ * every tick of _delay_*() (through tk-delay.h's DELAY_HOOK) adds the
+ * present draw times the time to a running total, and each whole mAh
+ * comes off the remaining charge.  The draw comes from the PWM duty on
+ * each channel, times what that channel pulls at full duty.
+ *
+ * Counting drifts (cell capacity, LED Vf), and it can't see a battery
+ * being charged or swapped, so each time the light comes on from a rest
+ * it's checked against the resting voltage: far off means a different
+ * battery, so the voltage wins; otherwise it's nudged a quarter of the
+ * way toward the voltage.  But a cell reads low for a while after high
+ * draw, and a clicky can't tell a rest from a few seconds off, so the
+ * last checkpoint also says whether the light was working hard (drawing
+ * FUEL_HOT_MA or more, and not FUEL_REST_MS at less since).  If it was,
+ * the voltage is only trusted when it says there's more charge (a
+ * charged or different cell), never less.
+ *
+ * Options:
+ *   FUEL_CH1_MA, FUEL_CH2_MA, FUEL_CH3_MA  current at full duty, in mA
+ *   FUEL_CAPACITY  cell capacity in mAh (default 3000)
+ *   FUEL_SAVE      mAh used between EEPROM checkpoints (default 1/32)
+ *   FUEL_HOT_MA    draw which makes the voltage sag (default 0.5C)
+ *   FUEL_REST_MS   time at a lower draw before it's trusted again (60s)
+ *
+ * Setup, in the firmware:
+ *   - DELAY_HOOK has to call fuel_tick(ms)
+ *   - whatever sets the PWM sets fuel_ma, with FUEL_MA(), or fuel_ua for
+ *     draws well under 1mA (like firefly pulses)
+ *   - output which doesn't wait in _delay_*() (like interrupt-driven
+ *     strobes) sets fuel_ma to its average, and counts its time with
+ *     fuel_ticks()
+ *   - on each boot, fuel_boot(opt, percent), before the output comes on
+ *   - once in a while (like each main loop), fuel_checkpoint(opt)
+ *
+ * The count lives in .noinit RAM, so it survives taps and standby, with
+ * a check word like tk-taps.h to catch garbage after a long time off.
+ * EEPROM, 2 bytes at the address given to fuel_boot(): mAh left, as of
+ * the last checkpoint, plus FUEL_HOT if it was working hard (0xffff is
+ * none yet).
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef FUEL_CH1_MA
+Hey, FUEL_GAUGE needs FUEL_CH1_MA (and CH2, CH3 for more channels).
+#endif
+
+#include <avr/eeprom.h>
+
+#ifndef FUEL_CAPACITY
+#define FUEL_CAPACITY 3000
+#endif
+#ifndef FUEL_SAVE
+#define FUEL_SAVE (FUEL_CAPACITY/32)
+#endif
+#ifndef FUEL_HOT_MA
+#define FUEL_HOT_MA (FUEL_CAPACITY/2)
+#endif
+#ifndef FUEL_REST_MS
+#define FUEL_REST_MS 60000U
+#endif
+#if (FUEL_CAPACITY >= 0x8000) || (FUEL_REST_MS > 65000)
+Hey, FUEL_CAPACITY or FUEL_REST_MS is too big.
+#endif
+// one mAh, in mA * ms
+#define FUEL_MAH 3600000UL
+// further than this from the resting voltage means it's a different battery
+#define FUEL_TRUST (FUEL_CAPACITY/4)
+#define FUEL_CHECK(mah) ((uint16_t)((mah) ^ 0xa55a))
+// top bit of the checkpoint: it was working hard, so the voltage reads low
+#define FUEL_HOT 0x8000
+
+// mA drawn by one channel at this duty (0 to 255)
+#define FUEL_MA(pwm, full) ((uint16_t)(((uint32_t)(pwm) * (full)) >> 8))
+
+uint16_t fuel_ma;     // draw right now
+uint16_t fuel_ua;     // ... plus this, in 1/1024 mA
+uint16_t fuel_sub;    // 1/1024 mA*ms toward the next mA*ms
+uint16_t fuel_cool;   // ms since the draw was FUEL_HOT_MA or more
+uint16_t fuel_saved;  // mAh left as of the last checkpoint
+uint8_t fuel_hot;     // the last checkpoint was while working hard
+uint16_t fuel_mah   __attribute__ ((section (".noinit")));  // mAh left
+uint32_t fuel_frac  __attribute__ ((section (".noinit")));  // mA*ms so far toward the next mAh
+uint16_t fuel_check __attribute__ ((section (".noinit")));
+
+/*
+ * Prototypes
+ */
+void fuel_tick(uint8_t ms);
+void fuel_ticks(uint16_t ms);
+void fuel_boot(uint8_t *opt, uint8_t percent);
+void fuel_checkpoint(uint8_t *opt);
+uint16_t fuel_minutes(uint16_t ma);
+
+/*
+ * Code
+ */
+
+void fuel_tick(uint8_t ms) {
+    uint32_t sub = fuel_sub + (uint32_t)fuel_ua * ms;
+    fuel_frac += (uint32_t)fuel_ma * ms + (sub >> 10);
+    fuel_sub = sub & 1023;
+    if (fuel_ma >= FUEL_HOT_MA) fuel_cool = 0;
+    else if (fuel_cool < FUEL_REST_MS) fuel_cool += ms;
+    while (fuel_frac >= FUEL_MAH) {
+        fuel_frac -= FUEL_MAH;
+        if (fuel_mah) fuel_mah --;
+    }
+    fuel_check = FUEL_CHECK(fuel_mah);
+}
+
+void fuel_ticks(uint16_t ms) {
+    // fuel_tick() for longer than 255ms at once
+    while (ms > 255) {
+        fuel_tick(255);
+        ms -= 255;
+    }
+    fuel_tick(ms);
+}
+
+void fuel_boot(uint8_t *opt, uint8_t percent) {
+    // Call before the output comes on, with the battery level (0 to 100)
+    // from a voltage reading.  That's only trusted after a rest, which
+    // is also when RAM doesn't survive.
+    uint16_t volt = (uint32_t)FUEL_CAPACITY * percent / 100;
+    fuel_saved = eeprom_read_word((uint16_t *)opt);
+    fuel_hot = (fuel_saved != 0xffff) && (fuel_saved & FUEL_HOT);
+    fuel_saved &= ~FUEL_HOT;
+    if (fuel_check == FUEL_CHECK(fuel_mah)) return;
+    // start from the last checkpoint...
+    fuel_mah = fuel_saved;
+    fuel_frac = 0;
+    fuel_cool = 0;
+    // ... unless there isn't one, or it's a charged or different battery
+    if ((fuel_mah > FUEL_CAPACITY) || (volt > fuel_mah + FUEL_TRUST))
+        fuel_mah = volt;
+    // (after working hard, the voltage still reads low for a while, so
+    //  it can't say there's less; keep counting from the checkpoint)
+    else if (! fuel_hot) {
+        if (volt + FUEL_TRUST < fuel_mah) fuel_mah = volt;
+        else fuel_mah = ((uint32_t)fuel_mah * 3 + volt) >> 2;
+    }
+    fuel_check = FUEL_CHECK(fuel_mah);
+}
+
+void fuel_checkpoint(uint8_t *opt) {
+    // saves to EEPROM only after a real change, either way (a new battery),
+    // or when it starts or stops working hard (twice per session at most)
+    uint16_t diff = (fuel_mah > fuel_saved) ? fuel_mah - fuel_saved : fuel_saved - fuel_mah;
+    uint8_t hot = fuel_hot;
+    if (fuel_ma >= FUEL_HOT_MA) hot = 1;
+    else if (fuel_cool >= FUEL_REST_MS) hot = 0;
+    if ((diff >= FUEL_SAVE) || (hot != fuel_hot)) {
+        eeprom_write_word((uint16_t *)opt, fuel_mah | (hot ? FUEL_HOT : 0));
+        fuel_saved = fuel_mah;
+        fuel_hot = hot;
+    }
+}
+
+uint16_t fuel_minutes(uint16_t ma) {
+    // runtime left at this draw (or 0xffff for "practically forever")
+    uint32_t minutes;
+    if (! ma) return 0xffff;
+    minutes = (uint32_t)fuel_mah * 60 / ma;
+    return (minutes > 0xffff) ? 0xffff : minutes;
+}
+
+#endif  // TK_FUEL_H
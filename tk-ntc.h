@@ -0,0 +1,86 @@
+#ifndef TK_NTC_H
+#define TK_NTC_H
+/*
+ * External NTC thermistor, for MCUs without a usable internal sensor.
+ * The thermistor goes from a spare ADC pin to ground, with a fixed
+ * resistor from VCC to the pin.  The ADC uses VCC as its reference, so
+ * battery voltage cancels out and the reading only depends on the two
+ * resistances.
+ *
+ * Readings are converted with a small lookup table from
+ * Scripts/ntc_calc.py (see tk-calibration.h).  The table is evenly spaced
+ * in ADC units, so interpolating needs only a shift, not a division.
+ * The result is the same 13.2 fixed-point, 0 = 0 C, that the internal
+ * sensor code returns, so thermal regulation doesn't need to know which
+ * one it's using.
+ *
+ * Needs NTC_CHANNEL and NTC_DIDR from the layout, TEMP_10bit, and
+ * ADC_on_temperature() from tk-voltage.h.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef NTC_CHANNEL
+Hey, this layout has no NTC_CHANNEL for tk-ntc.h.
+#endif
+#ifndef TEMP_10bit
+Hey, tk-ntc.h needs TEMP_10bit.
+#endif
+
+#include <avr/pgmspace.h>
+
+PROGMEM const uint8_t ntc_table[] = { NTC_TABLE };
+#define NTC_LAST (sizeof(ntc_table) - 1)
+
+/*
+ * Prototypes
+ */
+int16_t ntc_temperature();
+
+/*
+ * Code
+ */
+
+int16_t ntc_temperature() {
+    uint16_t sum = 0;
+    uint16_t frac;
+    uint8_t i;
+    int16_t temp, diff;
+
+    ADC_on_temperature();
+    // first reading after changing the reference is junk
+    get_temperature();
+    // 8 readings, same as the table expects
+    for(i=0; i<8; i++) {
+        sum += get_temperature();
+    }
+
+    // hotter than the table: clamp to its top
+    if (sum < NTC_SUM_MIN) sum = NTC_SUM_MIN;
+    sum -= NTC_SUM_MIN;
+    i = sum >> NTC_SHIFT;
+    // colder than the table: close enough
+    if (i >= NTC_LAST) return pgm_read_byte(&ntc_table[NTC_LAST]) << 2;
+
+    // interpolate between entries, in 13.2 fixed-point
+    frac = sum & ((1 << NTC_SHIFT) - 1);
+    temp = pgm_read_byte(&ntc_table[i]);
+    diff = pgm_read_byte(&ntc_table[i+1]) - temp;  // negative or zero
+    return (temp << 2) + ((diff * (int16_t)frac) >> (NTC_SHIFT - 2));
+}
+
+#endif  // TK_NTC_H
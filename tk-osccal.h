@@ -0,0 +1,185 @@
+#ifndef TK_OSCCAL_H
+#define TK_OSCCAL_H
+/*
+ * Internal RC oscillator calibration.
+ * The factory calibration is only good to about +/- 10%, which throws off
+ * every delay, ramp speed, and long timer.  This counts CPU clocks during
+ * one period of the (separate) watchdog oscillator and trims OSCCAL until
+ * the core clock matches F_CPU, as if the watchdog ran at WDT_HZ.
+ *
+ * That's only as good as the watchdog.  It isn't calibrated at all:
+ * 128 kHz is its nominal speed at 3V and 25C, and it differs by 10% or
+ * more from chip to chip, so each unit needs its own correction.  To
+ * measure one, osccal_count() counts watchdog periods while the user
+ * times a minute on a stopwatch, in a noinit counter, and the user ends
+ * it with a tap (RAM survives that).  osccal_counted() picks up the
+ * count on the next boot, and the firmware saves it in EEPROM: it's how
+ * many watchdog periods this unit has in a real minute.  From then on,
+ * osccal_target(saved count) is what to trim to, which puts the clock
+ * within about one OSCCAL step (~1%) plus how well the tap was timed,
+ * at the voltage and temperature where it was measured.  Without a
+ * saved count, the trim is still only within about +/- 10% of real
+ * time, but at least agrees with the watchdog.
+ *
+ * Include this before tk-delay.h.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "tk-attiny.h"
+#include <avr/interrupt.h>
+
+// the clock is trimmed to F_CPU, so no more per-driver fudge factor
+#undef BOGOMIPS
+#define BOGOMIPS (F_CPU/4000)
+
+// Watchdog oscillator speed (nominal; measure it for real accuracy)
+#ifndef WDT_HZ
+#define WDT_HZ 128000uL
+#endif
+// CPU clocks / 8 during one 16ms (2048-cycle) watchdog period
+#define OSCCAL_TARGET ((uint16_t)((F_CPU / 8) * 2048 / WDT_HZ))
+// watchdog periods in a minute, nominally, and how far off a unit can be
+#define OSCCAL_PER_MIN ((uint16_t)(WDT_HZ * 60 / 2048))
+#define OSCCAL_PER_MIN_LO (OSCCAL_PER_MIN - (OSCCAL_PER_MIN >> 2))
+#define OSCCAL_PER_MIN_HI (OSCCAL_PER_MIN + (OSCCAL_PER_MIN >> 2))
+// osccal_counting while osccal_count() runs (anything else is stale RAM)
+#define OSCCAL_COUNTING 0xC10C
+// stop when within ~0.8% (roughly one OSCCAL step)
+#define OSCCAL_TOLERANCE (OSCCAL_TARGET >> 7)
+// give up after this many steps
+#define OSCCAL_STEPS 64
+
+// survive a tap, so the next boot can see how far osccal_count() got
+uint16_t osccal_ticks __attribute__ ((section (".noinit")));
+uint16_t osccal_counting __attribute__ ((section (".noinit")));
+
+/*
+ * Prototypes
+ */
+uint16_t osccal_measure();
+uint8_t osccal_calibrate(uint16_t target);
+uint16_t osccal_target(uint16_t per_min);
+void osccal_count();
+uint16_t osccal_counted();
+
+/*
+ * Code
+ */
+
+uint16_t osccal_measure() {
+    // Count CPU clocks / 8 during one watchdog period.
+    // Uses Timer0 in normal mode; set up PWM after this, not before.
+    uint8_t overflows = 0;
+    uint8_t count;
+    TCCR0A = 0;
+    TCCR0B = (1 << CS01);  // clk/8
+    // Watchdog in interrupt mode, 16ms...  but with interrupts off,
+    // so it only sets a flag for us to poll.
+    WDTCR = (1 << WDCE) | (1 << WDE);
+    WDTCR = (1 << WDTIE);
+    // wait for a watchdog edge to start at
+    WDTCR |= (1 << WDTIF);
+    while (! (WDTCR & (1 << WDTIF))) {}
+    TCNT0 = 0;
+    TIFR0 = (1 << TOV0);
+    WDTCR |= (1 << WDTIF);
+    // ... and count until the next one
+    while (! (WDTCR & (1 << WDTIF))) {
+        if (TIFR0 & (1 << TOV0)) {
+            TIFR0 = (1 << TOV0);
+            overflows ++;
+        }
+    }
+    count = TCNT0;
+    // catch an overflow which happened after the last check
+    if ((TIFR0 & (1 << TOV0)) && (count < 128)) overflows ++;
+    return (overflows << 8) | count;
+}
+
+uint8_t osccal_calibrate(uint16_t target) {
+    // Trim OSCCAL one step at a time until the clock is close to F_CPU,
+    // with target from osccal_target().
+    // Returns the new OSCCAL value, for saving in EEPROM.
+    uint8_t i;
+    uint8_t sreg = SREG;
+    cli();
+    for (i=0; i<OSCCAL_STEPS; i++) {
+        uint16_t count = osccal_measure();
+        // (don't step past either end of the current OSCCAL range)
+        if (count > (target + OSCCAL_TOLERANCE)) {
+            if (! (OSCCAL & 0x7f)) break;
+            OSCCAL --;  // too fast
+        } else if (count < (target - OSCCAL_TOLERANCE)) {
+            if ((OSCCAL & 0x7f) == 0x7f) break;
+            OSCCAL ++;  // too slow
+        } else {
+            break;
+        }
+    }
+    // watchdog off
+    WDTCR = (1 << WDCE) | (1 << WDE);
+    WDTCR = 0;
+    SREG = sreg;
+    return OSCCAL;
+}
+
+uint16_t osccal_target(uint16_t per_min) {
+    // What osccal_measure() should read, given this unit's watchdog
+    // periods per real minute (or anything out of range, like an erased
+    // EEPROM, for the nominal WDT_HZ).
+    if ((per_min < OSCCAL_PER_MIN_LO) || (per_min > OSCCAL_PER_MIN_HI))
+        return OSCCAL_TARGET;
+    // a fast watchdog has fewer CPU clocks in each of its periods
+    return (uint32_t)OSCCAL_TARGET * OSCCAL_PER_MIN / per_min;
+}
+
+void osccal_count() {
+    // Count watchdog periods until the user taps, or until it's been
+    // twice as long as they should have needed.  Blocks everything else
+    // (even LVP) while it counts.
+    uint8_t sreg = SREG;
+    cli();
+    osccal_ticks = 0;
+    osccal_counting = OSCCAL_COUNTING;
+    // watchdog flag only, 16ms, like osccal_measure()
+    WDTCR = (1 << WDCE) | (1 << WDE);
+    WDTCR = (1 << WDTIE) | (1 << WDTIF);
+    while (osccal_ticks < (OSCCAL_PER_MIN << 1)) {
+        while (! (WDTCR & (1 << WDTIF))) {}
+        WDTCR |= (1 << WDTIF);
+        osccal_ticks ++;
+    }
+    // nobody tapped
+    osccal_counting = 0;
+    WDTCR = (1 << WDCE) | (1 << WDE);
+    WDTCR = 0;
+    SREG = sreg;
+}
+
+uint16_t osccal_counted() {
+    // Call early at boot.  If a tap interrupted osccal_count(), returns
+    // how many watchdog periods it counted (0 if that's not a plausible
+    // minute), otherwise 0xffff.
+    uint16_t ticks = osccal_ticks;
+    if (osccal_counting != OSCCAL_COUNTING) return 0xffff;
+    osccal_counting = 0;
+    if ((ticks < OSCCAL_PER_MIN_LO) || (ticks > OSCCAL_PER_MIN_HI)) return 0;
+    return ticks;
+}
+
+#endif  // TK_OSCCAL_H
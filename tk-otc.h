@@ -0,0 +1,152 @@
+#ifndef TK_OTC_H
+#define TK_OTC_H
+/*
+ * Off-time from the OTC, in milliseconds.
+ * While the light is off, the off-time capacitor discharges roughly
+ * exponentially, so the log of the reading falls in a straight line:
+ *
+ *   log2(reading) = level - (ms off / ms per bit)
+ *
+ * Two numbers per driver (where the line starts, and how steep it is)
+ * turn a 10-bit reading into time off, so short and medium presses can be
+ * time thresholds instead of readings measured on each kind of driver.
+ *
+ * EEPROM, 2 bytes starting at the address given to otc_load():
+ *   +0  level: log2 of the reading at the moment power was cut, minus 4,
+ *       in 3.5 fixed-point (so 1 unit is 1/32 of a bit)
+ *   +1  rate: ms per bit, divided by 8
+ * Either one at 0xff means uncalibrated, so OTC_LEVEL and OTC_RATE are
+ * used.  otc_fit() measures both from two presses of known length.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CAP_CHANNEL
+Hey, OTC_MODEL needs an off-time cap (CAP_PIN, CAP_CHANNEL, CAP_DIDR).
+#endif
+#ifndef OTC_LEVEL
+Hey, OTC_MODEL needs OTC_LEVEL and OTC_RATE from tk-calibration.h.
+#endif
+
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+
+// the two calibration presses, in ms
+#ifndef OTC_CAL_TAP_MS
+#define OTC_CAL_TAP_MS 150   // a tap, as quick as possible
+#endif
+#ifndef OTC_CAL_WAIT_MS
+#define OTC_CAL_WAIT_MS 3000 // off while counting to three
+#endif
+// readings this high may be clipped by the ADC, so they can't be fit
+#define OTC_CLIPPED 1000
+
+uint8_t otc_level = OTC_LEVEL;
+uint8_t otc_rate = OTC_RATE;
+
+// 32 * log2(1 + (i+0.5)/32), the fraction part of otc_log()
+PROGMEM const uint8_t otc_log_table[] = {
+    1, 2, 3, 5, 6, 7, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 25, 26, 27, 28, 29, 29, 30, 31, 32,
+};
+
+/*
+ * Prototypes
+ */
+uint16_t otc_read();
+uint8_t otc_log(uint16_t raw);
+uint16_t otc_ms(uint16_t raw);
+void otc_load(uint8_t *opt);
+uint8_t otc_fit(uint8_t *opt, uint8_t tap, uint8_t wait);
+
+/*
+ * Code
+ */
+
+uint16_t otc_read() {
+    // like read_otc(), but all 10 bits
+    DIDR0 |= (1 << CAP_DIDR);
+    // 1.1v reference, right-adjust, cap pin
+    ADMUX  = (1 << V_REF) | CAP_CHANNEL;
+    ADCSRA = (1 << ADEN ) | (1 << ADSC ) | ADC_PRSCL;
+    while (ADCSRA & (1 << ADSC));
+    // Start again as datasheet says first result is unreliable
+    ADCSRA |= (1 << ADSC);
+    while (ADCSRA & (1 << ADSC));
+    return ADC;
+}
+
+uint8_t otc_log(uint16_t raw) {
+    // log2(raw) - 4, in 3.5 fixed-point (0 for anything under 16)
+    uint8_t whole = 9;
+    if (raw < 16) return 0;
+    // slide the top bit up to bit 9, then the next 5 bits are the fraction
+    while (! (raw & 0x200)) {
+        raw <<= 1;
+        whole --;
+    }
+    return ((whole - 4) << 5) + pgm_read_byte(otc_log_table + ((raw >> 4) & 0x1f));
+}
+
+uint16_t otc_ms(uint16_t raw) {
+    // how long the light was off (roughly), or 0 if it was barely off
+    uint8_t l = otc_log(raw);
+    if (l >= otc_level) return 0;
+    // rate/8 ms per bit is rate/4 ms per 1/32 bit
+    return ((uint16_t)(otc_level - l) * otc_rate) >> 2;
+}
+
+void otc_load(uint8_t *opt) {
+    uint8_t level = eeprom_read_byte(opt);
+    uint8_t rate = eeprom_read_byte(opt + 1);
+    if ((level != 0xff) && (rate != 0xff)) {
+        otc_level = level;
+        otc_rate = rate;
+    }
+}
+
+uint8_t otc_fit(uint8_t *opt, uint8_t tap, uint8_t wait) {
+    // Fits the line through two otc_log() readings: one after a quick tap
+    // (OTC_CAL_TAP_MS) and one after a counted wait (OTC_CAL_WAIT_MS).
+    // Saves and returns 1 if it looks sane, otherwise goes back to the
+    // defaults and returns 0.  (0xff as the tap means it was clipped, and
+    // 0 as the wait means the cap drained below otc_log()'s range, so
+    // neither one is a real point on the line)
+    uint16_t rate, level;
+    // less than a quarter of a bit apart can't be a real slope
+    if ((tap != 0xff) && wait && (tap > wait + 8)) {
+        rate = ((OTC_CAL_WAIT_MS - OTC_CAL_TAP_MS) * 4L) / (tap - wait);
+        if (rate && (rate < 255)) {
+            // back up from the tap to when power was cut
+            level = tap + ((OTC_CAL_TAP_MS * 4) / rate);
+            if (level < 255) {
+                eeprom_write_byte(opt, level);
+                eeprom_write_byte(opt + 1, rate);
+                otc_level = level;
+                otc_rate = rate;
+                return 1;
+            }
+        }
+    }
+    eeprom_write_byte(opt, 0xff);
+    eeprom_write_byte(opt + 1, 0xff);
+    otc_level = OTC_LEVEL;
+    otc_rate = OTC_RATE;
+    return 0;
+}
+
+#endif  // TK_OTC_H
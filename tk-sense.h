@@ -0,0 +1,124 @@
+#ifndef TK_SENSE_H
+#define TK_SENSE_H
+/*
+ * Filtering and trend for a slow, noisy sensor (like temperature).
+ * Each sample goes through:
+ *   - median of the last 3 raw samples, so a single spike is thrown out
+ *   - an IIR lowpass, in fixed-point so small steps aren't lost
+ *   - a ring buffer of the last SENSE_SIZE filtered values, optionally
+ *     only every SENSE_DECIMATE'th one, for a longer window in the same RAM
+ * and sense_slope() fits a straight line to the ring buffer (least
+ * squares), which is much steadier than "newest minus oldest".
+ *
+ * Options:
+ *   SENSE_SIZE  samples in the slope window (4, 8, or 16)
+ *   SENSE_IIR   lowpass strength, as a shift (0 is off, 2 is about a
+ *               4-sample time constant)
+ *   SENSE_DECIMATE  samples per ring buffer entry (1, 2, 4, ...)
+ *
+ * Plain C with no hardware access, so Scripts/therm_bench.py can build
+ * it on the host and replay temperature traces through it.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+
+#ifndef SENSE_SIZE
+#define SENSE_SIZE 8
+#endif
+#if (SENSE_SIZE != 4) && (SENSE_SIZE != 8) && (SENSE_SIZE != 16)
+Hey, SENSE_SIZE should be 4, 8, or 16.
+#endif
+#ifndef SENSE_IIR
+#define SENSE_IIR 2
+#endif
+#ifndef SENSE_DECIMATE
+#define SENSE_DECIMATE 1
+#endif
+// sense_slope() is the change over this many ring buffer entries
+// (sum of squared distances from the middle of the window, halved)
+#define SENSE_SLOPE_DIV (SENSE_SIZE * (SENSE_SIZE*SENSE_SIZE - 1) / 6)
+
+int16_t sense_ring[SENSE_SIZE];
+uint8_t sense_idx;     // oldest value in the ring, next to be replaced
+#if (SENSE_DECIMATE > 1)
+uint8_t sense_tick;
+#endif
+int16_t sense_prev[2]; // last two raw samples, for the median
+int16_t sense_lp;      // lowpass output, with 4 extra bits
+
+/*
+ * Prototypes
+ */
+void sense_reset(int16_t value);
+int16_t sense_add(int16_t value);
+int16_t sense_slope();
+
+/*
+ * Code
+ */
+
+void sense_reset(int16_t value) {
+    // start out as if it had been reading this all along
+    uint8_t i;
+    for (i = 0; i < SENSE_SIZE; i++) sense_ring[i] = value;
+    sense_prev[0] = sense_prev[1] = value;
+    sense_lp = value << 4;
+    sense_idx = 0;
+}
+
+int16_t sense_add(int16_t value) {
+    // Adds a raw sample, returns the filtered value.
+    int16_t a = sense_prev[0], b = sense_prev[1], med;
+    sense_prev[0] = b;
+    sense_prev[1] = value;
+
+    // median of 3
+    if (a > b) { med = a; a = b; b = med; }
+    med = (value < a) ? a : (value > b) ? b : value;
+
+    sense_lp += ((med << 4) - sense_lp) >> SENSE_IIR;
+    med = (sense_lp + 8) >> 4;
+
+#if (SENSE_DECIMATE > 1)
+    if (! (++sense_tick & (SENSE_DECIMATE - 1)))
+#endif
+    {
+        sense_ring[sense_idx] = med;
+        sense_idx = (sense_idx + 1) & (SENSE_SIZE - 1);
+    }
+    return med;
+}
+
+int16_t sense_slope() {
+    // Least-squares slope, times SENSE_SLOPE_DIV.  That's the sum of
+    // (2i - (N-1)) * y[i] over the window, oldest first, which works out
+    // to (N+1) * sum(y) - 2 * sum(running sums), with no multiplies.
+    // (relative to the newest value, so the sums stay small)
+    int16_t newest = sense_ring[(sense_idx - 1) & (SENSE_SIZE - 1)];
+    int16_t total = 0, acc = 0;
+    uint8_t i, j = sense_idx;
+    for (i = 0; i < SENSE_SIZE; i++) {
+        total += sense_ring[j] - newest;
+        acc += total;
+        j = (j + 1) & (SENSE_SIZE - 1);
+    }
+    return (total * (SENSE_SIZE + 1)) - (acc << 1);
+}
+
+#endif  // TK_SENSE_H
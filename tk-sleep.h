@@ -0,0 +1,103 @@
+#ifndef TK_SLEEP_H
+#define TK_SLEEP_H
+/*
+ * Full shutdown, for poweroff and low-voltage cutoff.
+ * Plain sleep_mode() leaves timers clocked, the brown-out detector and
+ * analog comparator running, and pulled-up pins leaking, which is enough
+ * to keep draining an already-empty cell for months.  shutdown() turns
+ * off everything the MCU controls and then sleeps with interrupts off, so
+ * only a power cycle (clicking the switch) wakes it.
+ *
+ * What's left, roughly, at 4V (Scripts/sleep_budget.py checks this
+ * against the real register state, under simavr):
+ *
+ *   attiny13A   power-down core   ~0.2 uA
+ *   attiny25    power-down core   ~0.2 uA
+ *   either      brown-out detector   ~20 uA, only if the fuses enable it
+ *               and the chip can't turn it off during sleep (no BODS)
+ *   driver      voltage divider   V / (R1 + R2), ~150 uA with 22k+4.7k
+ *
+ * So the divider is by far the biggest part; use large resistors, or no
+ * divider at all (VOLTAGE_BANDGAP), for lights which sit after LVP.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+/*
+ * Prototypes
+ */
+void shutdown();
+
+/*
+ * Code
+ */
+
+void shutdown() {
+    uint8_t outputs = (1 << PWM_PIN);
+#ifdef ALT_PWM_PIN
+    outputs |= (1 << ALT_PWM_PIN);
+#endif
+#ifdef FET_PWM_PIN
+    outputs |= (1 << FET_PWM_PIN);
+#endif
+
+    cli();
+    GIMSK = 0;  // nothing should wake us
+
+    // stop the timers and their clocks
+    TCCR0A = 0;
+    TCCR0B = 0;
+#ifdef TCCR1
+    TCCR1 = 0;
+    GTCCR = 0;
+#endif
+#ifdef PLLCSR
+    PLLCSR = 0;
+#endif
+
+    // Park the pins: PWM outputs driven low (so the gates can't float up),
+    // everything else a plain input with no pull-up (a pull-up on a pin
+    // which is grounded on the board costs ~100 uA) and its digital input
+    // buffer off (a floating or mid-rail input can leak through it).
+    PORTB = 0;
+    DDRB = outputs;
+    DIDR0 = 0x3f;
+
+    // analog parts off (the ADC has to be off before PRR stops its clock)
+    ADCSRA = 0;
+    ACSR = (1 << ACD);
+#ifdef PRR
+    PRR = 0xff;
+#endif
+
+    MCUSR = 0;  // a watchdog reset flag keeps the watchdog on
+    wdt_disable();
+
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+#if defined(BODS) && defined(BODSE)
+    sleep_bod_disable();  // timed sequence; sleep has to follow right away
+#endif
+    sleep_cpu();
+    while (1) {}
+}
+
+#endif  // TK_SLEEP_H
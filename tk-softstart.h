@@ -0,0 +1,120 @@
+#ifndef TK_SOFTSTART_H
+#define TK_SOFTSTART_H
+/*
+ * Smooth transitions between output levels, in the background.
+ *
+ * set_mode() only sets a target (or sets the level again right away, if
+ * it's already there, so changes behind set_level() like VOLTAGE_COMP get
+ * through).  The output moves toward the target one step at a time while
+ * the UI waits in _delay_*(), through tk-delay.h's DELAY_HOOK,
+ * so LVP, thermal regulation, and everything else keep running while a
+ * transition happens.  set_level() is still instant, and cancels any
+ * transition in progress, so use that for blinks and strobes.
+ *
+ * Options:
+ *   SOFT_START_TIME    about how long a transition takes, in ms
+ *   SOFT_START_LINEAR  even steps in ramp levels (which are already
+ *                      perceptual, so this looks linear to the eye)
+ *                      instead of the default exponential curve, which
+ *                      jumps most of the way at first and then eases in
+ *
+ * Setup, in the firmware:
+ *   #define DELAY_HOOK soft_tick   (before including tk-delay.h)
+ *   #define soft_now actual_level  (if set_level() already keeps track)
+ *   ... and otherwise, set_level() needs to set soft_now = level.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SOFT_START_TIME
+#define SOFT_START_TIME 256
+#endif
+// a transition is about 16 steps (exactly 16 for linear)
+#define SOFT_START_STEP (SOFT_START_TIME/16)
+#if (SOFT_START_STEP < 4) || (SOFT_START_STEP > 250)
+Hey, SOFT_START_TIME should be between 64 and 4000 ms.
+#endif
+
+#ifndef soft_now
+uint8_t soft_now;     // level on the output right now
+#endif
+uint8_t soft_target;  // where we're going
+uint8_t soft_last;    // what we last put on the output
+uint8_t soft_ms;      // time since the last step
+#ifdef SOFT_START_LINEAR
+uint8_t soft_step;    // levels per step
+#endif
+
+/*
+ * Prototypes
+ */
+void set_level(uint8_t level);
+void set_mode(uint8_t level);
+void soft_tick(uint8_t ms);
+
+/*
+ * Code
+ */
+
+void set_mode(uint8_t level) {
+    // set_level() may have been called since, and that's fine
+    soft_last = soft_now;
+    if (level == soft_now) {
+        // already there, but set it again anyway, in case something
+        // behind set_level() changed (like voltage compensation)
+        soft_target = level;
+        set_level(level);
+        soft_last = soft_now;
+        return;
+    }
+    if (level != soft_target) {
+        soft_target = level;
+#ifdef SOFT_START_LINEAR
+        level = (level > soft_now) ? level - soft_now : soft_now - level;
+        soft_step = ((level - 1) >> 4) + 1;
+#endif
+        // take the first step right away
+        soft_ms = SOFT_START_STEP;
+    }
+    soft_tick(0);
+}
+
+void soft_tick(uint8_t ms) {
+    uint8_t dist, step;
+
+    // something else set the output, so stop fighting it
+    if (soft_now != soft_last) soft_target = soft_now;
+    if (soft_now == soft_target) return;
+
+    soft_ms += ms;
+    if (soft_ms < SOFT_START_STEP) return;
+    soft_ms -= SOFT_START_STEP;
+
+    dist = (soft_target > soft_now) ? soft_target - soft_now : soft_now - soft_target;
+#ifdef SOFT_START_LINEAR
+    step = soft_step;
+#else
+    step = (dist >> 2) | 1;  // a quarter of the way there
+#endif
+    if (step > dist) step = dist;
+
+    if (soft_target > soft_now) set_level(soft_now + step);
+    else set_level(soft_now - step);
+    soft_last = soft_now;
+}
+
+#endif  // TK_SOFTSTART_H
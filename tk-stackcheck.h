@@ -0,0 +1,87 @@
+#ifndef TK_STACKCHECK_H
+#define TK_STACKCHECK_H
+/*
+ * Runtime stack headroom check.
+ * At reset, before anything else runs, the free RAM between the end of
+ * .noinit and the top of the stack is painted with a canary byte.  Later,
+ * stack_check() counts how much paint is left (the stack grows down into
+ * it from the top) and saves the lowest count seen to one EEPROM byte.
+ * Read it back with a programmer: 0 means the stack reached .noinit and
+ * probably clobbered something, 0xff means it was never checked.
+ *
+ * This only measures the code paths which actually ran, so exercise every
+ * mode before trusting the number.  Scripts/stack_check.py does the static
+ * (worst-case) version at build time.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <avr/eeprom.h>
+
+#define STACK_CANARY 0xc5
+
+// from the linker script: first byte after .data, .bss, and .noinit
+extern uint8_t __heap_start;
+
+/*
+ * Prototypes
+ */
+void stack_paint() __attribute__ ((naked, used, section (".init1")));
+uint8_t stack_free();
+void stack_check(uint8_t *eep);
+
+/*
+ * Code
+ */
+
+void stack_paint() {
+    // Runs before the C runtime is set up (r1 isn't zero yet and there's
+    // no stack frame), so this has to be plain asm.  Nothing is on the
+    // stack at this point, so it's safe to paint all the way to RAMEND.
+    __asm__ volatile (
+        "    ldi r30, lo8(__heap_start)\n"
+        "    ldi r31, hi8(__heap_start)\n"
+        "    ldi r24, %0\n"
+        "    ldi r25, hi8(%1)\n"
+        "    rjmp 2f\n"
+        "1:  st Z+, r24\n"
+        "2:  cpi r30, lo8(%1)\n"
+        "    cpc r31, r25\n"
+        "    brlo 1b\n"
+        :: "M" (STACK_CANARY), "i" (RAMEND + 1));
+}
+
+uint8_t stack_free() {
+    // count untouched paint from the bottom up
+    uint8_t *p = &__heap_start;
+    uint8_t count = 0;
+    while ((*p == STACK_CANARY) && (count < 255)) {
+        p ++;
+        count ++;
+    }
+    return count;
+}
+
+void stack_check(uint8_t *eep) {
+    // Only writes when there's a new low, so it wears out the EEPROM at
+    // most once per byte of RAM.  Reading it back each time costs less
+    // than keeping a copy in our tiny RAM.
+    uint8_t headroom = stack_free();
+    if (headroom < eeprom_read_byte(eep)) eeprom_write_byte(eep, headroom);
+}
+
+#endif  // TK_STACKCHECK_H
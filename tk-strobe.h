@@ -0,0 +1,143 @@
+#ifndef TK_STROBE_H
+#define TK_STROBE_H
+/*
+ * Interrupt-driven strobe timing.
+ * Timer0 is switched from PWM to CTC mode, and its compare-match interrupt
+ * flips the output at each edge.  Edges land on exact timer ticks, so the
+ * frequency doesn't depend on loop overhead, and the main loop is free to
+ * sleep or do other things (like LVP) while the strobe runs.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "tk-attiny.h"
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+
+// Timer0 clock while strobing: F_CPU/64 (13.3us ticks at 4.8 MHz, 8us at
+// 8 MHz), so the slowest strobe period (~120ms) still fits in 16 bits.
+// (Scripts/strobe_check.py runs the interrupt on the PC to check each mode)
+#define STROBE_PRESCALE     64
+#define STROBE_CS           ((1 << CS01) | (1 << CS00))
+#define STROBE_TICKS_PER_MS ((uint8_t)((F_CPU/STROBE_PRESCALE + 500) / 1000))
+// convert times to timer ticks (at compile time)
+#define STROBE_US(us) ((uint16_t)(((F_CPU/STROBE_PRESCALE) * (uint32_t)(us) + 500000) / 1000000))
+#define STROBE_MS(ms) STROBE_US((ms)*1000uL)
+#define STROBE_HZ(hz) ((uint16_t)((F_CPU/STROBE_PRESCALE + (hz)/2) / (hz)))
+// too-short segments could be missed after the interrupt latency
+#define STROBE_MIN_TICKS    2
+
+// Which output gets flashed
+#ifdef FET_PWM_LVL
+// the FET lives on Timer1, which keeps running; just flip its duty cycle
+#define strobe_light_on()   (FET_PWM_LVL = 255)
+#define strobe_light_off()  (FET_PWM_LVL = 0)
+#else
+// Timer0's outputs are disconnected in CTC mode, so drive the pin directly
+#define strobe_light_on()   (PORTB |= (1 << PWM_PIN))
+#define strobe_light_off()  (PORTB &= ~(1 << PWM_PIN))
+#endif
+
+/*
+ * Prototypes
+ */
+void strobe_start();
+void strobe_stop();
+void strobe_set(uint16_t ontime, uint16_t offtime);
+void strobe_wait(uint8_t flashes);
+
+/*
+ * Code
+ */
+
+volatile uint16_t strobe_ontime;   // ticks
+volatile uint16_t strobe_offtime;  // ticks
+volatile uint8_t strobe_flashes;   // incremented at the end of each flash
+uint16_t strobe_left;              // ticks until the next edge
+uint8_t strobe_lit;
+
+ISR(TIM0_COMPA_vect) {
+    uint16_t left = strobe_left;
+    if (! left) {  // time for an edge
+        if (strobe_lit) {
+            strobe_light_off();
+            left = strobe_offtime;
+            strobe_flashes ++;
+        } else {
+            strobe_light_on();
+            left = strobe_ontime;
+        }
+        strobe_lit ^= 1;
+    }
+    // count down in chunks which can't be shorter than half a timer cycle,
+    // so the last chunk never ends up too short to hit
+    if (left > 255) {
+        OCR0A = 127;
+        left -= 128;
+    } else {
+        OCR0A = left - 1;
+        left = 0;
+    }
+    strobe_left = left;
+}
+
+void strobe_set(uint16_t ontime, uint16_t offtime) {
+    // takes effect at the next edge
+    if (ontime < STROBE_MIN_TICKS) ontime = STROBE_MIN_TICKS;
+    if (offtime < STROBE_MIN_TICKS) offtime = STROBE_MIN_TICKS;
+    cli();
+    strobe_ontime = ontime;
+    strobe_offtime = offtime;
+    sei();
+}
+
+void strobe_start() {
+    if (TIMSK0 & (1 << OCIE0A)) return;  // already running
+    strobe_lit = 0;
+    strobe_left = 0;
+    // no PWM while strobing; make sure the Timer0 pins are off too
+#ifdef ALT_PWM_PIN
+    PORTB &= ~((1 << PWM_PIN) | (1 << ALT_PWM_PIN));
+#else
+    PORTB &= ~(1 << PWM_PIN);
+#endif
+    OCR0A = STROBE_MIN_TICKS;  // first edge right away
+    TCNT0 = 0;
+    TCCR0A = (1 << WGM01);  // CTC mode, outputs disconnected
+    TCCR0B = STROBE_CS;
+    TIMSK0 |= (1 << OCIE0A);
+    sei();
+}
+
+void strobe_stop() {
+    TIMSK0 &= ~(1 << OCIE0A);
+    strobe_light_off();
+    // back to normal PWM timing (caller should set_level() afterward)
+    TCCR0B = 0x01;
+    TCCR0A = PHASE;
+}
+
+void strobe_wait(uint8_t flashes) {
+    // sleep until this many more flashes are done
+    uint8_t end = strobe_flashes + flashes;
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (strobe_flashes != end) {
+        sleep_mode();
+    }
+}
+
+#endif  // TK_STROBE_H
@@ -0,0 +1,49 @@
+#ifndef TK_TAPS_H
+#define TK_TAPS_H
+/*
+ * Multi-click state which survives short power-off periods.
+ * The state lives in .noinit RAM, like g_u8fast_presses, so a UI can span
+ * several presses without writing anything to EEPROM until the user is
+ * done.  A check byte catches garbage after a long off time or a cold
+ * start, so stale state reads as "idle" instead of a bogus value.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#define TAP_IDLE 0
+#define TAP_CHECK(state, val) ((uint8_t)(((state) ^ (val)) ^ 0xa5))
+
+uint8_t g_u8tap_state __attribute__ ((section (".noinit")));
+uint8_t g_u8tap_val   __attribute__ ((section (".noinit")));
+uint8_t g_u8tap_check __attribute__ ((section (".noinit")));
+
+static inline void tap_arm(uint8_t state, uint8_t val) {
+    g_u8tap_state = state;
+    g_u8tap_val = val;
+    g_u8tap_check = TAP_CHECK(state, val);
+}
+
+#define tap_disarm() tap_arm(TAP_IDLE, 0)
+
+static inline uint8_t tap_armed() {
+    // returns the current state, or TAP_IDLE if RAM didn't survive
+    if (g_u8tap_check != TAP_CHECK(g_u8tap_state, g_u8tap_val))
+        return TAP_IDLE;
+    return g_u8tap_state;
+}
+
+#endif  // TK_TAPS_H
@@ -0,0 +1,112 @@
+#ifndef TK_TEMPCAL_H
+#define TK_TEMPCAL_H
+/*
+ * Per-unit calibration for the MCU's internal temperature sensor.
+ * The sensor is about one ADC step per degree C, but where 0 C lands
+ * varies by tens of steps from one chip to the next, and the slope by a
+ * few percent.  So an uncalibrated temperature limit means something
+ * different on every light.
+ *
+ *   - First boot (EEPROM erased): the light has been sitting unpowered
+ *     at room temperature, TEMPCAL_AMBIENT, so one reading gives this
+ *     chip's offset.  Flash it, then power it up once at room temperature
+ *     before it gets warm.
+ *   - Second point (TEMPCAL_2POINT, optional): write a known temperature
+ *     in C into the third byte with a programmer, let the light sit
+ *     unpowered at that temperature (an oven, or a freezer), then turn it
+ *     on.  That measures the slope too, and clears the byte again.
+ *
+ * EEPROM, 3 bytes starting at the address given to tempcal_init():
+ *   +0  reading at TEMPCAL_AMBIENT, minus (TEMP_ORIGIN+TEMPCAL_AMBIENT-128)
+ *   +1  slope, C per step in 1.7 fixed-point (128 = 1.0)
+ *   +2  second point's temperature in C, or 255 for none
+ *
+ * Setup, in the firmware:
+ *   #define TEMP_ORIGIN ...       (typical reading at 0 C)
+ *   #define TEMPCAL_READ() ...    (a fresh, averaged reading, in ADC steps)
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <avr/eeprom.h>
+
+// room temperature for the first-boot reading, in C
+#ifndef TEMPCAL_AMBIENT
+#define TEMPCAL_AMBIENT 21
+#endif
+#define TEMPCAL_BASE (TEMP_ORIGIN + TEMPCAL_AMBIENT - 128)
+#define TEMPCAL_ONE 128  // slope of exactly 1 C per step
+
+// reading at TEMPCAL_AMBIENT (the typical one, until calibrated)
+uint16_t tempcal_ref = TEMP_ORIGIN + TEMPCAL_AMBIENT;
+#ifdef TEMPCAL_2POINT
+uint8_t tempcal_slope = TEMPCAL_ONE;
+#endif
+
+/*
+ * Prototypes
+ */
+void tempcal_init(uint8_t *opt);
+int16_t tempcal_celsius(int16_t raw);
+
+/*
+ * Code
+ */
+
+void tempcal_init(uint8_t *opt) {
+    uint8_t cal = eeprom_read_byte(opt);
+    int16_t raw;
+
+    if (cal == 0xff) {
+        // first boot, at room temperature
+        raw = TEMPCAL_READ() - TEMPCAL_BASE;
+        if (raw < 0) raw = 0;
+        if (raw > 254) raw = 254;
+        cal = raw;
+        eeprom_write_byte(opt, cal);
+    }
+    tempcal_ref = TEMPCAL_BASE + cal;
+
+#ifdef TEMPCAL_2POINT
+    cal = eeprom_read_byte(opt + 2);
+    if (cal != 0xff) {
+        // second point: slope is degrees apart over steps apart
+        raw = TEMPCAL_READ() - tempcal_ref;
+        int16_t degrees = (int16_t)cal - TEMPCAL_AMBIENT;
+        // (too close together, or backward, to be useful)
+        if ((raw > 8) || (raw < -8)) {
+            degrees = (degrees << 7) / raw;
+            if ((degrees >= TEMPCAL_ONE/2) && (degrees < 255))
+                eeprom_write_byte(opt + 1, degrees);
+        }
+        eeprom_write_byte(opt + 2, 0xff);
+    }
+    cal = eeprom_read_byte(opt + 1);
+    if (cal != 0xff) tempcal_slope = cal;
+#endif
+}
+
+int16_t tempcal_celsius(int16_t raw) {
+    // raw reading in 13.2 fixed-point to C in 13.2 fixed-point
+    raw -= tempcal_ref << 2;
+#ifdef TEMPCAL_2POINT
+    raw = ((int32_t)raw * tempcal_slope) >> 7;
+#endif
+    return raw + (TEMPCAL_AMBIENT << 2);
+}
+
+#endif  // TK_TEMPCAL_H
@@ -0,0 +1,120 @@
+#ifndef TK_THERMCAL_H
+#define TK_THERMCAL_H
+/*
+ * Temperature limit calibration.
+ * The light runs at full power while this watches the temperature.  The
+ * highest value seen so far is the ceiling candidate, and a filtered
+ * trend shows when the heating curve has leveled off.  The user can cut
+ * the power at any moment, so EEPROM has to keep up with the peak:
+ * a big enough rise is saved right away, and a smaller one after a few
+ * samples, so there's at most one write per THERMCAL_INTERVAL samples
+ * for the slow creep near the top.  The peak never goes back down, so a
+ * whole run writes at most once per degree it heats up, no matter how
+ * long it's left on.  Once the curve is flat (or the limit is hit), the
+ * caller should save one last time and drop the output.
+ *
+ * Units are whatever the caller uses for its ceiling, as long as they
+ * fit in a byte.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// save right away when the peak has moved at least this far
+#ifndef THERMCAL_MIN_DELTA
+#define THERMCAL_MIN_DELTA 2
+#endif
+// ... or any smaller change, after this many samples without a save
+#ifndef THERMCAL_INTERVAL
+#define THERMCAL_INTERVAL 8
+#endif
+// a trend below this is "flat" (4.4 fixed-point units per sample)
+#ifndef THERMCAL_FLAT
+#define THERMCAL_FLAT 1
+#endif
+// how many flat samples in a row before we're done
+#ifndef THERMCAL_SETTLE
+#define THERMCAL_SETTLE 32
+#endif
+
+// thermcal_sample() results
+#define THERMCAL_SAVE 1  // caller should save thermcal_peak now
+#define THERMCAL_DONE 2  // converged, turn the power down
+
+uint8_t thermcal_peak;     // highest temperature so far
+uint8_t thermcal_saved;    // what's in EEPROM now
+uint8_t thermcal_last;     // previous sample
+uint8_t thermcal_since;    // samples since the last save
+uint8_t thermcal_flat;     // how many flat samples in a row
+int16_t thermcal_trend;    // filtered change per sample, 4.4 fixed-point
+
+/*
+ * Prototypes
+ */
+void thermcal_start(uint8_t saved, uint8_t temp);
+uint8_t thermcal_sample(uint8_t temp, uint8_t limit);
+
+/*
+ * Code
+ */
+
+void thermcal_start(uint8_t saved, uint8_t temp) {
+    thermcal_saved = saved;
+    thermcal_peak = temp;
+    thermcal_last = temp;
+    thermcal_since = 0;
+    thermcal_flat = 0;
+    thermcal_trend = 0;
+}
+
+uint8_t thermcal_sample(uint8_t temp, uint8_t limit) {
+    uint8_t result = 0;
+    uint8_t delta;
+
+    if (temp > limit) temp = limit;
+
+    // lowpass the change per sample; the sensor is noisy
+    thermcal_trend += ((((int16_t)temp - thermcal_last) << 4) - thermcal_trend) >> 2;
+    thermcal_last = temp;
+    if (temp > thermcal_peak) thermcal_peak = temp;
+
+    if (thermcal_trend < THERMCAL_FLAT) {
+        if (thermcal_flat < 255) thermcal_flat ++;
+    } else {
+        thermcal_flat = 0;
+    }
+    if ((thermcal_flat >= THERMCAL_SETTLE) || (thermcal_peak >= limit)) {
+        result = THERMCAL_DONE;
+    }
+
+    // save the peak when it moves a useful amount, when a smaller move
+    // has waited long enough, or at the end
+    if (thermcal_since < 255) thermcal_since ++;
+    if (thermcal_peak > thermcal_saved) delta = thermcal_peak - thermcal_saved;
+    else delta = thermcal_saved - thermcal_peak;
+    if (delta
+        && ((result & THERMCAL_DONE)
+            || (delta >= THERMCAL_MIN_DELTA)
+            || (thermcal_since >= THERMCAL_INTERVAL))) {
+        thermcal_saved = thermcal_peak;
+        thermcal_since = 0;
+        result |= THERMCAL_SAVE;
+    }
+
+    return result;
+}
+
+#endif  // TK_THERMCAL_H
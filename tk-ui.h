@@ -0,0 +1,110 @@
+#ifndef TK_UI_H
+#define TK_UI_H
+/*
+ * Table-driven clicky UI.
+ * The UI is a list of states.  Each one has a mode (what the light does
+ * while in that state) and says where a tap, a timeout, and a long press
+ * go from there, with an optional action on the way.  Scripts/ui_compile.py
+ * builds the table from a readable description (UI/<firmware>.ui) and checks
+ * it for unreachable states and dead ends, so a different UI is a different
+ * table, not different code.
+ *
+ * The table has 4 bytes per state: the mode, then a transition for each
+ * event.  A transition is (action << 5) | next state, where next state 31
+ * means stay put and action 0 means none.  Fast taps (N quick taps in a
+ * row) are a short separate list, checked at boot before the normal tap.
+ *
+ * Setup, in the firmware:
+ *   #define UI_TABLE "name-ui.h"   (the compiled table)
+ *   #define ui_state ...           (optional: an existing .noinit byte)
+ *   void ui_action(uint8_t action) (handles the UI_ACT_* actions)
+ * Then call ui_boot() once per power-on, ui_mode() to see what to run, and
+ * ui_event(UI_TIMEOUT) when a mode's tap window closes.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <avr/pgmspace.h>
+#include UI_TABLE
+
+// events, which are also the column in each state's row
+#define UI_TAP     1
+#define UI_TIMEOUT 2
+#define UI_LONG    3
+#define UI_STAY    31
+
+#ifndef ui_state
+// survives a tap, like the rest of the clicky state
+uint8_t ui_state __attribute__ ((section (".noinit")));
+#endif
+
+PROGMEM const uint8_t ui_table[] = { UI_STATE_TABLE };
+#ifdef UI_TAPS_TABLE
+PROGMEM const uint8_t ui_taps[] = { UI_TAPS_TABLE };
+#endif
+
+/*
+ * Prototypes
+ */
+void ui_action(uint8_t action);
+void ui_go(uint8_t transition);
+void ui_event(uint8_t event);
+uint8_t ui_mode();
+void ui_boot(uint8_t long_press, uint8_t fast_presses);
+
+/*
+ * Code
+ */
+
+void ui_go(uint8_t transition) {
+    uint8_t next = transition & 0x1f;
+    if (next != UI_STAY) ui_state = next;
+    if (transition >> 5) ui_action(transition >> 5);
+}
+
+void ui_event(uint8_t event) {
+    ui_go(pgm_read_byte(ui_table + (ui_state << 2) + event));
+}
+
+uint8_t ui_mode() {
+    // memory or a bad EEPROM could have put us anywhere
+    if (ui_state >= UI_COUNT) ui_state = UI_START;
+    return pgm_read_byte(ui_table + (ui_state << 2));
+}
+
+void ui_boot(uint8_t long_press, uint8_t fast_presses) {
+    // RAM decayed into something which isn't a state, so it was off a while
+    if (ui_state >= UI_COUNT) {
+        ui_state = UI_START;
+        long_press = 1;
+    }
+    if (long_press) {
+        ui_event(UI_LONG);
+        return;
+    }
+#ifdef UI_TAPS_TABLE
+    for (const uint8_t *p = ui_taps; pgm_read_byte(p); p += 2) {
+        if (pgm_read_byte(p) == fast_presses) {
+            ui_go(pgm_read_byte(p + 1));
+            return;
+        }
+    }
+#endif
+    ui_event(UI_TAP);
+}
+
+#endif  // TK_UI_H
@@ -0,0 +1,82 @@
+#ifndef TK_USERGROUPS_H
+#define TK_USERGROUPS_H
+/*
+ * User-programmable mode groups, stored in EEPROM.
+ * The first NUM_USER_GROUPS mode groups can be replaced by the user.
+ * Each one takes 9 bytes in the upper half of EEPROM (the lower half is
+ * used for mode index wear leveling):
+ *   - a flags byte: top bit clear when the group is programmed, low bits
+ *     say which hidden modes to append (one bit per hidden mode)
+ *   - up to 8 ramp levels, cut short with a zero like the PROGMEM groups
+ * Erased EEPROM reads as 0xff, which means "not programmed", so the
+ * group from PROGMEM is used instead.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <avr/eeprom.h>
+
+#define USERGROUP_BASE     (EEPSIZE/2)
+#define USERGROUP_SIZE     9
+#define USERGROUP_ADDR(g)  (USERGROUP_BASE + ((g) * USERGROUP_SIZE))
+#define USERGROUP_EMPTY    0x80  // set when the group isn't programmed
+#define USERGROUP_HIDDEN   0x7f  // hidden modes to add, one bit each
+// (leave the top few bytes for OPT_* config values)
+#if (USERGROUP_ADDR(NUM_USER_GROUPS) > (EEPSIZE - 12))
+Hey, NUM_USER_GROUPS is too big for this EEPROM.
+#endif
+
+/*
+ * Prototypes
+ */
+uint8_t usergroup_flags(uint8_t group);
+void usergroup_begin(uint8_t group);
+void usergroup_set_level(uint8_t group, uint8_t slot, uint8_t level);
+void usergroup_finish(uint8_t group, uint8_t count, uint8_t flags);
+
+/*
+ * Code
+ */
+
+uint8_t usergroup_flags(uint8_t group) {
+    // flags for a programmed group, or USERGROUP_EMPTY if it isn't one
+    if (group >= NUM_USER_GROUPS) return USERGROUP_EMPTY;
+    return eeprom_read_byte((uint8_t *)USERGROUP_ADDR(group));
+}
+
+#define usergroup_level(group, slot) \
+    eeprom_read_byte((uint8_t *)(USERGROUP_ADDR(group) + 1 + (slot)))
+
+void usergroup_begin(uint8_t group) {
+    // mark the group unprogrammed until it's finished, so a half-done
+    // group falls back to the default instead
+    eeprom_write_byte((uint8_t *)USERGROUP_ADDR(group), 0xff);
+}
+
+void usergroup_set_level(uint8_t group, uint8_t slot, uint8_t level) {
+    eeprom_write_byte((uint8_t *)(USERGROUP_ADDR(group) + 1 + slot), level);
+}
+
+void usergroup_finish(uint8_t group, uint8_t count, uint8_t flags) {
+    // no levels at all means "go back to the default group"
+    if (! count) return;
+    if (count < 8) usergroup_set_level(group, count, 0);
+    eeprom_write_byte((uint8_t *)USERGROUP_ADDR(group),
+                      flags & USERGROUP_HIDDEN);
+}
+
+#endif  // TK_USERGROUPS_H
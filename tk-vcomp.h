@@ -0,0 +1,92 @@
+#ifndef TK_VCOMP_H
+#define TK_VCOMP_H
+/*
+ * Constant-brightness compensation for direct-drive (FET) channels.
+ * FET current falls roughly in proportion to (voltage - VCOMP_KNEE), so
+ * scale the duty cycle by (VCOMP_REF - VCOMP_KNEE) / (voltage - VCOMP_KNEE)
+ * to hold the brightness each level has at VCOMP_REF.  Above VCOMP_REF this
+ * trims the output; below it, it boosts until PWM hits 255 and the headroom
+ * is gone.  Below ADC_LOW it backs off completely so LVP step-downs (and
+ * thermal step-downs, which lower the level) actually reduce the output.
+ * The factor only moves VCOMP_SLEW per update, though, so backing off
+ * (from up to 2x, right at ADC_LOW) is a fade over several seconds
+ * instead of a sudden drop that looks like the light stepping down.
+ *
+ * Setup, in the firmware:
+ *   - pass each voltage reading to vcomp_update()
+ *   - set_level() puts vcomp(pwm) on the FET channel
+ *   - call set_mode() (or set_level()) again after vcomp_update(), since
+ *     a new factor only reaches the output the next time the level is set
+ *
+ * Plain C with no hardware access (ADC_* come from tk-calibration.h), so
+ * Scripts/vcomp_check.py can build it on the host.
+ *
+ * Copyright (C) 2017 Selene Scriven
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+
+#ifndef VCOMP_REF
+#define VCOMP_REF   ADC_38  // nominal brightness at this (loaded) voltage
+#endif
+#ifndef VCOMP_KNEE
+#define VCOMP_KNEE  ADC_27  // where the FET stops driving much current
+#endif
+#ifndef VCOMP_MAX
+#define VCOMP_MAX   255     // highest boost, 1.7 fixed-point (255 ~= 2x)
+#endif
+#ifndef VCOMP_SLEW
+#define VCOMP_SLEW  4       // most the factor changes per update
+#endif
+
+uint16_t vcomp_avg = (VCOMP_REF << 3);  // low-passed voltage, 8.3 fixed-point
+uint8_t vcomp_factor = 128;  // duty cycle multiplier, 1.7 fixed-point
+
+/*
+ * Prototypes
+ */
+void vcomp_update(uint8_t voltage);
+static inline uint8_t vcomp(uint8_t pwm);
+
+/*
+ * Code
+ */
+
+void vcomp_update(uint8_t voltage) {
+    // voltage is noisy and sags with load, so filter it heavily
+    vcomp_avg += voltage - (vcomp_avg >> 3);
+    voltage = vcomp_avg >> 3;
+    uint16_t target = 128;
+    if (voltage >= ADC_LOW) {
+        target = ((VCOMP_REF - VCOMP_KNEE) << 7) / (voltage - VCOMP_KNEE);
+        if (target > VCOMP_MAX) target = VCOMP_MAX;
+    }
+    // ease toward it, so crossing ADC_LOW doesn't halve the output at once
+    if (target > vcomp_factor + VCOMP_SLEW) vcomp_factor += VCOMP_SLEW;
+    else if (target + VCOMP_SLEW < vcomp_factor) vcomp_factor -= VCOMP_SLEW;
+    else vcomp_factor = target;
+}
+
+static inline uint8_t vcomp(uint8_t pwm) {
+    uint16_t scaled = ((uint16_t)pwm * vcomp_factor) >> 7;
+    if (scaled > 255) scaled = 255;
+    // don't let the lowest levels vanish at full charge
+    if (pwm && (! scaled)) scaled = 1;
+    return scaled;
+}
+
+#endif  // TK_VCOMP_H
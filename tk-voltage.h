@@ -22,6 +22,9 @@
 
 #include "tk-attiny.h"
 #include "tk-calibration.h"
+#ifdef VOLTAGE_BANDGAP
+#include <util/delay_basic.h>
+#endif
 
 /*
  * Prototypes
@@ -32,7 +35,13 @@ void ADC_on_temperature();
 #endif // TEMPERATURE_MON || THERMAL_REGULATION
 
 #ifdef VOLTAGE_MON
-#  define NEED_ADC_8bit
+#  ifdef VOLTAGE_BANDGAP
+#    define NEED_ADC_10bit
+void vbg_calibrate(uint8_t trim);
+uint8_t get_voltage();
+#  else
+#    define NEED_ADC_8bit
+#  endif
 static inline void ADC_on();
 #else
 static inline void ADC_off();
@@ -44,6 +53,12 @@ static inline uint8_t read_adc_8bit();
 #ifdef NEED_ADC_10bit
 static inline uint16_t read_adc_10bit();
 #endif // NEED_ADC_10bit
+#ifdef CHEM_SELECT
+void chem_select(uint8_t idx);
+#endif
+#if (defined(USE_BATTCHECK) && ! defined(BATTCHECK_VpT)) || defined(FUEL_GAUGE)
+uint8_t battery_percent(uint8_t voltage);
+#endif
 #ifdef USE_BATTCHECK
 static inline uint8_t battcheck();
 #endif // USE_BATTCHECK
@@ -58,10 +73,17 @@ static inline uint8_t battcheck();
 #    define NEED_ADC_10bit
 #    define get_temperature read_adc_10bit
 #  else
+#    define NEED_ADC_8bit
 #    define get_temperature read_adc_8bit
 #  endif
 
 void ADC_on_temperature() {
+#ifdef THERM_NTC
+    // external thermistor: VCC reference, right-adjust
+    // (ratiometric, so the battery voltage doesn't matter)
+    ADMUX  = NTC_CHANNEL;
+    DIDR0 |= (1 << NTC_DIDR);
+#else
     // TODO: (?) enable ADC Noise Reduction Mode, Section 17.7 on page 128
     //       (apparently can only read while the CPU is in idle mode though)
     // select ADC4 by writing 0b00001111 to ADMUX
@@ -73,12 +95,67 @@ void ADC_on_temperature() {
 #endif
     // disable digital input on ADC pin to reduce power consumption
     //DIDR0 |= (1 << TEMP_DIDR);
+#endif  // ifdef THERM_NTC
     // enable, start, prescale
     ADCSRA = (1 << ADEN ) | (1 << ADSC ) | ADC_PRSCL;
 }
 #endif  // TEMPERATURE_MON
 
 #ifdef VOLTAGE_MON
+#ifdef VOLTAGE_BANDGAP
+/*
+ * No divider: the MCU runs straight from the cell (through the driver's
+ * diode), so measure the 1.1V bandgap against VCC and work backward.
+ * The ADC reads 1024 * VBG / VCC, so VCC = 1024 * VBG / reading.
+ * Results are in 20mV units (4.2V = 210), to fit a byte; tk-calibration.h
+ * sets the ADC_* thresholds to match, so battcheck and LVP just work.
+ *
+ * The bandgap is only 1.1V +/- 10%, so each unit should be calibrated:
+ * run battcheck at a known voltage and set the trim to
+ * (1100 * actual / shown) - 1000, in mV.
+ */
+#  ifndef BANDGAP_CHANNEL
+Hey, this MCU has no way to measure its bandgap against VCC.  Turn off VOLTAGE_BANDGAP.
+#  endif
+#  ifndef VBG_MV
+#    define VBG_MV 1100  // bandgap voltage, when there's no trim saved
+#  endif
+#  ifndef VBG_DIODE_DROP
+#    define VBG_DIODE_DROP 0  // diode drop at light load, in 20mV units
+#  endif
+// 1024 * VBG in 20mV units (fits 16 bits up to 1.27V)
+#  define VBG_SCALE(mv) ((uint16_t)((mv) * 1024UL / 20))
+uint16_t vbg_scale = VBG_SCALE(VBG_MV);
+
+void vbg_calibrate(uint8_t trim) {
+    // trim is the bandgap voltage minus 1000mV; 0xff means none saved
+    if (trim != 0xff) vbg_scale = VBG_SCALE(1000 + trim);
+}
+
+void ADC_on() {
+    // VCC reference, right-adjust, bandgap
+    ADMUX  = BANDGAP_CHANNEL;
+    // enable, start, prescale
+    ADCSRA = (1 << ADEN ) | (1 << ADSC ) | ADC_PRSCL;
+}
+
+uint8_t get_voltage() {
+    uint16_t sum;
+    uint8_t i;
+    // Switching the reference (temperature uses 1.1V internal) or turning
+    // on the bandgap takes about 1ms to settle, per the datasheet, and the
+    // first reading after that is still junk.
+    ADC_on();
+    _delay_loop_2(BOGOMIPS);
+    read_adc_10bit();
+    for (i=0, sum=0; i<4; i++) sum += read_adc_10bit();
+    // average, rounded; a low reading means a high voltage
+    sum = (sum + 2) >> 2;
+    if (sum == 0) return 255;
+    sum = (vbg_scale + (sum >> 1)) / sum + VBG_DIODE_DROP;
+    return (sum > 255) ? 255 : sum;
+}
+#else
 #  define NEED_ADC_8bit
 void ADC_on() {
     // disable digital input on ADC pin to reduce power consumption
@@ -90,12 +167,72 @@ void ADC_on() {
 }
 
 #  define get_voltage read_adc_8bit
+#endif // VOLTAGE_BANDGAP
 #else // VOLTAGE_MON
 void ADC_off() {
     ADCSRA &= ~(1<<7); //ADC off
 }
 #endif // VOLTAGE_MON
 
+#ifdef VOLTAGE_MON
+/*
+ * Battery chemistry: LVP thresholds, step-down size, and the resting
+ * voltage to state-of-charge curve, from the profiles in tk-calibration.h.
+ * With CHEM_SELECT, all of them are in flash and chem_select() picks one
+ * (usually from EEPROM); otherwise only CHEMISTRY is built in.
+ */
+#  define SOC_POINTS 9
+#  ifdef CHEM_SELECT
+#    define CHEM_SIZE (3 + SOC_POINTS)
+PROGMEM const uint8_t chem_profiles[CHEM_COUNT][CHEM_SIZE] = {
+    { LIION_LOW,   LIION_CRIT,   LIION_STEP,   LIION_SOC },
+    { LIFEPO4_LOW, LIFEPO4_CRIT, LIFEPO4_STEP, LIFEPO4_SOC },
+    { NIMH3_LOW,   NIMH3_CRIT,   NIMH3_STEP,   NIMH3_SOC },
+};
+uint8_t chem_idx = CHEMISTRY;
+#    define chem_read(i) pgm_read_byte(&chem_profiles[chem_idx][i])
+#    define soc_point(i) chem_read(3 + (i))
+void chem_select(uint8_t idx) {
+    // anything else (like 0xff, unconfigured) keeps the default
+    if (idx < CHEM_COUNT) chem_idx = idx;
+}
+#  else
+PROGMEM const uint8_t soc_curve[SOC_POINTS] = { CHEM_SOC };
+#    define soc_point(i) pgm_read_byte(soc_curve + (i))
+#  endif
+
+static inline uint8_t lvp_step(uint8_t level) {
+    // level after one LVP step-down, but never off (0), even when a small
+    // step (like LiFePO4's) rounds the low levels down to nothing;
+    // the firmware decides when to shut off
+    level = ((uint16_t)level * LVP_STEP) >> 3;
+    return level ? level : 1;
+}
+
+#  if (defined(USE_BATTCHECK) && ! defined(BATTCHECK_VpT)) || defined(FUEL_GAUGE)
+uint8_t battery_percent(uint8_t voltage) {
+    // 0 to 100, linear between the points of the resting-voltage curve
+    uint8_t i, lo, hi;
+    if (voltage <= soc_point(0)) return 0;
+    for (i=1; (i < SOC_POINTS-1) && (voltage > soc_point(i)); i++) {}
+    lo = soc_point(i-1);
+    hi = soc_point(i);
+    if (voltage > hi) return 100;  // past the last point
+    // each segment is 12.5%
+    return ((i-1)*25 + (uint16_t)(voltage - lo) * 25 / (hi - lo)) >> 1;
+}
+#  endif
+#endif  // VOLTAGE_MON
+
+#ifdef VOLTAGE_COMP
+#  ifndef VOLTAGE_MON
+Hey, VOLTAGE_COMP needs VOLTAGE_MON.
+#  endif
+#  include "tk-vcomp.h"
+#else
+#  define vcomp(pwm) (pwm)
+#endif // VOLTAGE_COMP
+
 #ifdef NEED_ADC_8bit
 uint8_t read_adc_8bit() {
     // Start conversion
@@ -122,32 +259,6 @@ static inline uint16_t read_adc_10bit() {
 #endif // NEED_ADC_10bit
 
 #ifdef USE_BATTCHECK
-#  ifdef BATTCHECK_4bars
-PROGMEM const uint8_t voltage_blinks[] = {
-    // 0 blinks for less than 1%
-    ADC_0p,    // 1 blink  for 1%-25%
-    ADC_25p,   // 2 blinks for 25%-50%
-    ADC_50p,   // 3 blinks for 50%-75%
-    ADC_75p,   // 4 blinks for 75%-100%
-    ADC_100p,  // 5 blinks for >100%
-    255,       // Ceiling, don't remove  (6 blinks means "error")
-};
-#  endif  // BATTCHECK_4bars
-#  ifdef BATTCHECK_8bars
-PROGMEM const uint8_t voltage_blinks[] = {
-    // 0 blinks for less than 1%
-    ADC_30,    // 1 blink  for 1%-12.5%
-    ADC_33,    // 2 blinks for 12.5%-25%
-    ADC_35,    // 3 blinks for 25%-37.5%
-    ADC_37,    // 4 blinks for 37.5%-50%
-    ADC_38,    // 5 blinks for 50%-62.5%
-    ADC_39,    // 6 blinks for 62.5%-75%
-    ADC_40,    // 7 blinks for 75%-87.5%
-    ADC_41,    // 8 blinks for 87.5%-100%
-    ADC_42,    // 9 blinks for >100%
-    255,       // Ceiling, don't remove  (10 blinks means "error")
-};
-#  endif  // BATTCHECK_8bars
 #  ifdef BATTCHECK_VpT
 /*
 PROGMEM const uint8_t v_whole_blinks[] = {
@@ -209,16 +320,21 @@ uint8_t battcheck() {
     return pgm_read_byte(voltage_blinks + i + 1);
 }
 #else  // #ifdef BATTCHECK_VpT
+#  ifdef BATTCHECK_8bars
+#    define BATTCHECK_BARS 8
+#  else
+#    define BATTCHECK_BARS 4
+#  endif
 uint8_t battcheck() {
-    // Return an int, number of "blinks", for approximate battery charge
-    // Uses the table above for return values
-    uint8_t i, voltage;
+    // Return an int, number of "blinks", for approximate battery charge:
+    // 0 for empty, 1 to BATTCHECK_BARS by charge, one more for over 100%
+    uint8_t voltage, percent;
     voltage = get_voltage();
-    // figure out how many times to blink
-    for (i=0;
-            voltage > pgm_read_byte(voltage_blinks + i);
-            i ++) {}
-    return i;
+    if (voltage <= soc_point(0)) return 0;
+    if (voltage > soc_point(SOC_POINTS-1)) return BATTCHECK_BARS + 1;
+    // round up, so each bar starts right after the one before it
+    percent = (battery_percent(voltage) * BATTCHECK_BARS + 99) / 100;
+    return percent ? percent : 1;
 }
 #endif  // BATTCHECK_VpT
 #endif